@@ -1,11 +1,15 @@
 #pragma once
 
 #include "raytracer.h"
+#include "taskUtils.h"
 #include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cfloat>
 #include <chrono>
 #include <iostream>
 #include <limits>
+#include <vector>
 
 ispc::float3 add(ispc::float3 a, ispc::float3 b) {
     ispc::float3 c;
@@ -80,32 +84,39 @@ ispc::Interval getAxis(ispc::aabb bbox, int axis) {
     return bbox.x;
 }
 
-size_t newNode(std::vector<ispc::Node>& nodes, ispc::aabb box, size_t start, size_t size, size_t left, size_t right) {
-    ispc::Node node;
-    node.bbox = box;
-    node.start = start;
-    node.size = size;
-    node.left = left;
-    node.right = right;
-    nodes.push_back(node);
-    return nodes.size() - 1;
-}
+// Binned SAH construction
+
+const int bvhNumBins = 16;
+const float bvhTraversalCost = 1.0f;
+const float bvhIntersectionCost = 1.0f;
+
+// Entries in the stack of the packet traversal (BVH_STACK_SIZE in bvh.isph). It pushes at most one
+// entry per inner node on the path to a leaf, so no tree may be deeper than this.
+const uint32_t bvhStackSize = 128;
+
+// Primitive reference used during construction. The builder works on these instead of the
+// hittables themselves so that bounding boxes are read through the void* once per primitive.
+struct PrimitiveRef {
+    ispc::aabb bbox;
+    ispc::float3 centroid;
+    uint32_t index;
+};
 
-ispc::aabb calculateBbox(std::vector<ispc::Hittable>& objects, size_t left, size_t right) {
-    auto start = objects.begin() + left;
-    auto end = objects.begin() + right;
+struct Bin {
+    ispc::aabb bbox;
+    uint32_t count;
+};
+
+ispc::aabb emptyAABB() {
     ispc::aabb box;
     box.x = ispc::Interval{FLT_MAX, -FLT_MAX};
     box.y = ispc::Interval{FLT_MAX, -FLT_MAX};
     box.z = ispc::Interval{FLT_MAX, -FLT_MAX};
-    for (auto it = start; it != end; it++) {
-        ispc::Hittable hittable = *it;
-        box = createAABB(box, getAABB(hittable));
-    }
-
     return box;
 }
 
+ispc::aabb growAABB(ispc::aabb box, ispc::float3 p) { return createAABB(box, createAABB(p, p)); }
+
 ispc::float3 center(ispc::aabb box) {
     return ispc::float3{(box.x.min + box.x.max) / 2.0f, (box.y.min + box.y.max) / 2.0f, (box.z.min + box.z.max) / 2.0f};
 }
@@ -117,78 +128,312 @@ float surfaceArea(ispc::aabb box) {
     return 2.0f * (x * y + y * z + z * x);
 }
 
-float calculateSAH(std::vector<ispc::Hittable>& objects, size_t left, size_t right, int axis, float split, float sc) {
-    auto start = objects.begin() + left;
-    auto end = objects.begin() + right;
+void writeNode(std::vector<ispc::Node>& nodes, size_t index, ispc::aabb box, size_t start, size_t size, size_t left,
+               size_t right) {
+    ispc::Node& node = nodes[index];
+    node.bbox = box;
+    node.start = start;
+    node.size = size;
+    node.left = left;
+    node.right = right;
+}
+
+// Ranges at least this large are split across tasks: subtrees are built concurrently and the
+// bounds and binning passes over a range are chunked.
+const size_t bvhParallelSubtreeSize = 4096;
+const size_t bvhParallelBinningSize = 1 << 16;
+const size_t bvhTaskChunkSize = 1 << 14;
+const int bvhMaxTasks = 64;
+
+std::vector<PrimitiveRef> createPrimitiveRefs(const std::vector<ispc::Hittable>& objects) {
+    std::vector<PrimitiveRef> refs(objects.size());
+    parallelChunks(objects.size(), bvhTaskChunkSize, bvhMaxTasks, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; i++) {
+            refs[i].bbox = getAABB(objects[i]);
+            refs[i].centroid = center(refs[i].bbox);
+            refs[i].index = i;
+        }
+    });
+    return refs;
+}
 
-    auto predicate = [&split, &axis](ispc::Hittable& obj) { return center(getAABB(obj)).v[axis] < split; };
+struct Bounds {
+    ispc::aabb bbox;
+    ispc::aabb centroidBox;
+};
 
-    auto middle = std::partition(start, end, predicate);
-    size_t middleIndex = middle - objects.begin();
+Bounds emptyBounds() { return Bounds{emptyAABB(), emptyAABB()}; }
 
-    size_t nA = middleIndex - left;
-    size_t nB = right - middleIndex;
+Bounds mergeBounds(const Bounds& a, const Bounds& b) {
+    return Bounds{createAABB(a.bbox, b.bbox), createAABB(a.centroidBox, b.centroidBox)};
+}
 
-    auto bboxA = calculateBbox(objects, left, middleIndex);
-    float sA = surfaceArea(bboxA) / sc;
+Bounds computeBounds(const std::vector<PrimitiveRef>& refs, size_t start, size_t end) {
+    Bounds bounds = emptyBounds();
+    for (size_t i = start; i < end; i++) {
+        bounds.bbox = createAABB(bounds.bbox, refs[i].bbox);
+        bounds.centroidBox = growAABB(bounds.centroidBox, refs[i].centroid);
+    }
+    return bounds;
+}
 
-    auto bboxB = calculateBbox(objects, middleIndex, right);
-    float sB = surfaceArea(bboxB) / sc;
+Bounds computeBoundsParallel(const std::vector<PrimitiveRef>& refs, size_t start, size_t end) {
+    if (end - start < bvhParallelBinningSize) {
+        return computeBounds(refs, start, end);
+    }
 
-    return sA * nA + sB * nB;
+    std::vector<Bounds> partial(bvhMaxTasks, emptyBounds());
+    int chunks = parallelChunks(end - start, bvhTaskChunkSize, bvhMaxTasks, [&](size_t begin, size_t chunkEnd, int task) {
+        partial[task] = computeBounds(refs, start + begin, start + chunkEnd);
+    });
+
+    Bounds bounds = emptyBounds();
+    for (int i = 0; i < chunks; i++) {
+        bounds = mergeBounds(bounds, partial[i]);
+    }
+    return bounds;
 }
 
-size_t constructBVH(std::vector<ispc::Hittable>& objects, std::vector<ispc::Node>& nodes, size_t start, size_t end, const uint32_t maxLeafSize) {
-    size_t size = end - start;
+int binIndex(float c, float min, float scale) {
+    int bin = (int)((c - min) * scale);
+    return std::clamp(bin, 0, bvhNumBins - 1);
+}
+
+struct BinGrid {
+    float min[3];
+    float scale[3];
+};
 
-    if (size <= maxLeafSize) {
-        return newNode(nodes, calculateBbox(objects, start, end), start, size, 0, 0);
+BinGrid createBinGrid(ispc::aabb centroidBox) {
+    BinGrid grid;
+    for (int axis = 0; axis < 3; axis++) {
+        ispc::Interval extent = getAxis(centroidBox, axis);
+        grid.min[axis] = extent.min;
+        grid.scale[axis] = intervalSize(extent) > 0.0f ? bvhNumBins / intervalSize(extent) : 0.0f;
     }
+    return grid;
+}
 
-    const int numPartitions = 10;
+struct BinSet {
+    Bin bins[3][bvhNumBins];
+};
 
-    auto currentBbox = calculateBbox(objects, start, end);
-    float sa = surfaceArea(currentBbox);
+void clearBins(BinSet& set) {
+    for (int axis = 0; axis < 3; axis++) {
+        for (int b = 0; b < bvhNumBins; b++) {
+            set.bins[axis][b].bbox = emptyAABB();
+            set.bins[axis][b].count = 0;
+        }
+    }
+}
+
+// Bins the centroids of refs[start, end) on all three axes in a single pass.
+void binRefs(const std::vector<PrimitiveRef>& refs, size_t start, size_t end, const BinGrid& grid, BinSet& set) {
+    for (size_t i = start; i < end; i++) {
+        const PrimitiveRef& ref = refs[i];
+        for (int axis = 0; axis < 3; axis++) {
+            Bin& bin = set.bins[axis][binIndex(ref.centroid.v[axis], grid.min[axis], grid.scale[axis])];
+            bin.bbox = createAABB(bin.bbox, ref.bbox);
+            bin.count++;
+        }
+    }
+}
 
-    float bestSAH = std::numeric_limits<float>::max();
-    int bestAxis = 0;
-    float bestSplit = 0.0f;
+struct Split {
+    float cost;
+    int axis;
+    int bin;
+};
 
+// Sweeps the bins for the cheapest SAH split. Returns a split with axis -1 if the centroids
+// cannot be separated.
+Split sweepBins(const BinSet& set, const BinGrid& grid, float parentArea) {
+    Split best = {std::numeric_limits<float>::max(), -1, 0};
     for (int axis = 0; axis < 3; axis++) {
-        float min = getAxis(currentBbox, axis).min;
-        float max = getAxis(currentBbox, axis).max;
-        float range = max - min;
-        for (int i = 1; i <= numPartitions; i++) {
-            float split = min + range * ((float)i / (float)numPartitions);
-            float SAH = calculateSAH(objects, start, end, axis, split, sa);
-
-            if (SAH < bestSAH) {
-                bestSAH = SAH;
-                bestAxis = axis;
-                bestSplit = split;
+        if (grid.scale[axis] == 0.0f) {
+            continue;
+        }
+        const Bin* bins = set.bins[axis];
+
+        // Sweep from the right to get the area and count of everything above each split plane.
+        float rightArea[bvhNumBins];
+        uint32_t rightCount[bvhNumBins];
+        ispc::aabb box = emptyAABB();
+        uint32_t count = 0;
+        for (int b = bvhNumBins - 1; b > 0; b--) {
+            box = createAABB(box, bins[b].bbox);
+            count += bins[b].count;
+            rightArea[b] = surfaceArea(box);
+            rightCount[b] = count;
+        }
+
+        // Sweep from the left, splitting between bin b - 1 and bin b.
+        box = emptyAABB();
+        count = 0;
+        for (int b = 1; b < bvhNumBins; b++) {
+            box = createAABB(box, bins[b - 1].bbox);
+            count += bins[b - 1].count;
+            if (count == 0 || rightCount[b] == 0) {
+                continue;
+            }
+            float cost = bvhTraversalCost +
+                         bvhIntersectionCost * (surfaceArea(box) * count + rightArea[b] * rightCount[b]) / parentArea;
+            if (cost < best.cost) {
+                best = {cost, axis, b};
             }
         }
     }
 
-    auto bestPredicate = [&bestSplit, &bestAxis](ispc::Hittable& obj) {
-        return center(getAABB(obj)).v[bestAxis] < bestSplit;
-    };
+    return best;
+}
 
-    auto middle = std::partition(objects.begin() + start, objects.begin() + end, bestPredicate);
-    size_t middleIndex = middle - objects.begin();
+Split findBinnedSplit(const std::vector<PrimitiveRef>& refs, size_t start, size_t end, const Bounds& bounds) {
+    BinGrid grid = createBinGrid(bounds.centroidBox);
+    BinSet set;
+    clearBins(set);
+
+    if (end - start < bvhParallelBinningSize) {
+        binRefs(refs, start, end, grid, set);
+    } else {
+        std::vector<BinSet> partial(bvhMaxTasks);
+        int chunks = parallelChunks(end - start, bvhTaskChunkSize, bvhMaxTasks, [&](size_t begin, size_t chunkEnd, int task) {
+            clearBins(partial[task]);
+            binRefs(refs, start + begin, start + chunkEnd, grid, partial[task]);
+        });
+        for (int i = 0; i < chunks; i++) {
+            for (int axis = 0; axis < 3; axis++) {
+                for (int b = 0; b < bvhNumBins; b++) {
+                    Bin& bin = set.bins[axis][b];
+                    bin.bbox = createAABB(bin.bbox, partial[i].bins[axis][b].bbox);
+                    bin.count += partial[i].bins[axis][b].count;
+                }
+            }
+        }
+    }
 
-    size_t left = constructBVH(objects, nodes, start, middleIndex, maxLeafSize);
-    size_t right = constructBVH(objects, nodes, middleIndex, end, maxLeafSize);
+    return sweepBins(set, grid, surfaceArea(bounds.bbox));
+}
+
+// Shared state of one build. Nodes go into a preallocated array (a binary tree over n primitives
+// has at most 2n - 1 nodes); sibling pairs are reserved with a single atomic add so concurrent
+// subtree tasks never resize it.
+struct BuildContext {
+    std::vector<PrimitiveRef>& refs;
+    std::vector<ispc::Node>& nodes;
+    std::atomic<uint32_t> nodeCount;
+    uint32_t maxLeafSize;
+};
+
+void constructBVH(BuildContext& ctx, size_t nodeIndex, size_t start, size_t end, const Bounds& bounds,
+                  uint32_t depth) {
+    size_t size = end - start;
+
+    if (size == 1) {
+        writeNode(ctx.nodes, nodeIndex, bounds.bbox, start, size, 0, 0);
+        return;
+    }
 
-    return newNode(nodes, currentBbox, start, size, left, right);
+    Split split = findBinnedSplit(ctx.refs, start, end, bounds);
+
+    // Make a leaf when intersecting everything is no more expensive than the best split. The
+    // maximum leaf size still forces a split so leaves stay bounded for the traversal.
+    float leafCost = bvhIntersectionCost * size;
+    if (size <= ctx.maxLeafSize && (split.axis < 0 || leafCost <= split.cost)) {
+        writeNode(ctx.nodes, nodeIndex, bounds.bbox, start, size, 0, 0);
+        return;
+    }
+
+    size_t middleIndex;
+    if (depth + std::bit_width(size - 1) >= bvhStackSize) {
+        // Only a balanced subtree still fits under the depth limit, so halve the range at the median
+        // centroid along the widest axis.
+        int axis = 0;
+        for (int a = 1; a < 3; a++) {
+            if (intervalSize(getAxis(bounds.centroidBox, a)) > intervalSize(getAxis(bounds.centroidBox, axis))) {
+                axis = a;
+            }
+        }
+        middleIndex = start + size / 2;
+        std::nth_element(ctx.refs.begin() + start, ctx.refs.begin() + middleIndex, ctx.refs.begin() + end,
+                         [&](const PrimitiveRef& a, const PrimitiveRef& b) {
+                             return a.centroid.v[axis] < b.centroid.v[axis];
+                         });
+    } else if (split.axis < 0) {
+        // All centroids coincide, so any split is as good as another.
+        middleIndex = start + size / 2;
+    } else {
+        ispc::Interval extent = getAxis(bounds.centroidBox, split.axis);
+        float scale = bvhNumBins / intervalSize(extent);
+        auto predicate = [&](const PrimitiveRef& ref) {
+            return binIndex(ref.centroid.v[split.axis], extent.min, scale) < split.bin;
+        };
+        auto middle = std::partition(ctx.refs.begin() + start, ctx.refs.begin() + end, predicate);
+        middleIndex = middle - ctx.refs.begin();
+    }
+
+    size_t left = ctx.nodeCount.fetch_add(2);
+    size_t right = left + 1;
+    writeNode(ctx.nodes, nodeIndex, bounds.bbox, start, size, left, right);
+
+    if (size < bvhParallelSubtreeSize) {
+        constructBVH(ctx, left, start, middleIndex, computeBounds(ctx.refs, start, middleIndex), depth + 1);
+        constructBVH(ctx, right, middleIndex, end, computeBounds(ctx.refs, middleIndex, end), depth + 1);
+        return;
+    }
+
+    launchTasks(2, [&](int child, int) {
+        size_t childStart = child == 0 ? start : middleIndex;
+        size_t childEnd = child == 0 ? middleIndex : end;
+        constructBVH(ctx, child == 0 ? left : right, childStart, childEnd,
+                     computeBoundsParallel(ctx.refs, childStart, childEnd), depth + 1);
+    });
+}
+
+// Longest path from the root to a leaf. Children are always allocated after their parent, so one
+// pass in index order sees every parent first.
+uint32_t treeDepth(const std::vector<ispc::Node>& nodes) {
+    std::vector<uint32_t> depth(nodes.size(), 0);
+    uint32_t maxDepth = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const ispc::Node& node = nodes[i];
+        if (node.left != node.right) {
+            depth[node.left] = depth[i] + 1;
+            depth[node.right] = depth[i] + 1;
+            maxDepth = std::max(maxDepth, depth[i] + 1);
+        }
+    }
+    return maxDepth;
 }
 
 ispc::Bvh* createBVH(std::vector<ispc::Hittable>& objects, std::vector<ispc::Node>& nodes, const uint32_t maxLeafSize) {
+    auto buildStart = std::chrono::high_resolution_clock::now();
+
     ispc::Bvh* bvh = new ispc::Bvh;
+    std::vector<PrimitiveRef> refs = createPrimitiveRefs(objects);
+
+    nodes.resize(std::max<size_t>(2 * refs.size(), 2) - 1);
+    BuildContext ctx{refs, nodes, {1}, std::max(maxLeafSize, 1u)};
+    constructBVH(ctx, 0, 0, refs.size(), computeBoundsParallel(refs, 0, refs.size()), 0);
+    nodes.resize(ctx.nodeCount);
+    bvh->root = 0;
+
+    // Leaves index contiguous ranges of refs, so put the hittables in the same order.
+    std::vector<ispc::Hittable> ordered(objects.size());
+    parallelChunks(refs.size(), bvhTaskChunkSize, bvhMaxTasks, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; i++) {
+            ordered[i] = objects[refs[i].index];
+        }
+    });
+    objects.swap(ordered);
+
     bvh->objects = objects.data();
     bvh->numObjects = objects.size();
-    bvh->root = constructBVH(objects, nodes, 0, objects.size(), maxLeafSize);
     bvh->nodes = nodes.data();
     bvh->numNodes = nodes.size();
+    bvh->depth = treeDepth(nodes);
+
+    auto buildEnd = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(buildEnd - buildStart);
+    std::cout << "BVH build time: " << duration.count() << " milliseconds (" << nodes.size() << " nodes)" << std::endl;
     return bvh;
 }
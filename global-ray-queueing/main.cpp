@@ -5,6 +5,7 @@
 #include <algorithm>
 #include <cfloat>
 #include <chrono>
+#include <cstring>
 #include <iostream>
 #include <limits>
 #include <random>
@@ -19,10 +20,13 @@ int main(int argc, char* argv[]) {
     bool useBVH;
     int bvhMaxLeafSize;
     int scene;
+    RenderSettings renderSettings;
 
-    if (argc != 9) {
+    if (argc < 9) {
         std::cout << "Usage: " << argv[0]
-                  << " <image width> <samples per pixel> <max depth> <vfov> <usePackets> <useBVH> <BVH leaf size> <scene>" << std::endl;
+                  << " <image width> <samples per pixel> <max depth> <vfov> <usePackets> <useBVH> <BVH leaf size> <scene>"
+                  << " [--batch=N] [--sort=none|octant|morton] [--sort-benchmark] [--ray-memory=MB]"
+                  << std::endl;
         return 1;
     }
 
@@ -35,6 +39,25 @@ int main(int argc, char* argv[]) {
     bvhMaxLeafSize = atoi(argv[7]);
     scene = atoi(argv[8]);
 
+    for (int i = 9; i < argc; i++) {
+        if (strncmp(argv[i], "--batch=", 8) == 0) {
+            renderSettings.options.batchSize = std::max(atoi(argv[i] + 8), 0);
+        } else if (strcmp(argv[i], "--sort=none") == 0) {
+            renderSettings.options.raySort = ispc::RaySort::NO_SORT;
+        } else if (strcmp(argv[i], "--sort=octant") == 0) {
+            renderSettings.options.raySort = ispc::RaySort::OCTANT_SORT;
+        } else if (strcmp(argv[i], "--sort=morton") == 0) {
+            renderSettings.options.raySort = ispc::RaySort::MORTON_SORT;
+        } else if (strcmp(argv[i], "--sort-benchmark") == 0) {
+            renderSettings.sortBenchmark = true;
+        } else if (strncmp(argv[i], "--ray-memory=", 13) == 0) {
+            renderSettings.options.rayMemoryMB = std::max(atoi(argv[i] + 13), 0);
+        } else {
+            std::cout << "Unknown option: " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
     // Print out parameters
     std::cout << "Image Width: " << imageWidth << std::endl;
     std::cout << "Samples per Pixel: " << samplesPerPixel << std::endl;
@@ -43,6 +66,9 @@ int main(int argc, char* argv[]) {
     std::cout << "Use Packets: " << usePackets << std::endl;
     std::cout << "Use BVH: " << useBVH << std::endl;
     std::cout << "BVH Leaf Size: " << bvhMaxLeafSize << std::endl;
+    std::cout << "Batch Size: " << renderSettings.options.batchSize << std::endl;
+    std::cout << "Ray Sort: " << raySortName(renderSettings.options.raySort) << std::endl;
+    std::cout << "Ray Memory (MB): " << renderSettings.options.rayMemoryMB << std::endl;
 
     // Set up Scene
     float ZOOM = 30.0f;
@@ -51,21 +77,22 @@ int main(int argc, char* argv[]) {
     switch (scene) {
     case 1:
         std::cout << "Scene: Cornell Box" << std::endl;
-        cornellBox(imageWidth, samplesPerPixel, maxDepth, vfov, useBVH, bvhMaxLeafSize, usePackets);
+        cornellBox(imageWidth, samplesPerPixel, maxDepth, vfov, useBVH, bvhMaxLeafSize, usePackets, renderSettings);
         break;
     case 2:
         std::cout << "Scene: random spheres" << std::endl;
-        randomSpheres(imageWidth, samplesPerPixel, maxDepth, vfov, useBVH, bvhMaxLeafSize, usePackets); // From book
+        randomSpheres(imageWidth, samplesPerPixel, maxDepth, vfov, useBVH, bvhMaxLeafSize, usePackets,
+                      renderSettings); // From book
         break;
     case 3:
         std::cout << "Scene: random spheres w/ extra spheres" << std::endl;
-        randomSpheres(imageWidth, samplesPerPixel, maxDepth, vfov, useBVH, bvhMaxLeafSize, usePackets, NUM_SPHERES,
-                      ZOOM); // More Spheres
+        randomSpheres(imageWidth, samplesPerPixel, maxDepth, vfov, useBVH, bvhMaxLeafSize, usePackets, renderSettings,
+                      NUM_SPHERES, ZOOM); // More Spheres
         break;
     case 4:
         std::cout << "Scene: middle random spheres" << std::endl;
-        randomSpheres(imageWidth, samplesPerPixel, maxDepth, vfov, useBVH, bvhMaxLeafSize, usePackets, 20,
-                      ZOOM / 2); // More Spheres
+        randomSpheres(imageWidth, samplesPerPixel, maxDepth, vfov, useBVH, bvhMaxLeafSize, usePackets, renderSettings,
+                      20, ZOOM / 2); // More Spheres
         break;
     default:
         std::cout << "Invalid scene number" << std::endl;
@@ -58,6 +58,15 @@ enum MaterialType {
 };
 #endif
 
+#ifndef __ISPC_ENUM_RaySort__
+#define __ISPC_ENUM_RaySort__
+enum RaySort {
+    NO_SORT = 0,
+    OCTANT_SORT = 1,
+    MORTON_SORT = 2 
+};
+#endif
+
 
 #ifndef __ISPC_ALIGN__
 #if defined(__clang__) || !defined(_MSC_VER)
@@ -76,10 +85,10 @@ enum MaterialType {
 struct Bvh {
     struct Hittable * objects;
     struct Node * nodes;
-    struct RayQueue * rayQueues;
     uint32_t numNodes;
     uint32_t numObjects;
     uint32_t root;
+    uint32_t depth;
 };
 #endif
 
@@ -119,14 +128,6 @@ struct Node {
 };
 #endif
 
-#ifndef __ISPC_STRUCT_RayQueue__
-#define __ISPC_STRUCT_RayQueue__
-struct RayQueue {
-    bool * inQueue;
-    uint32_t size;
-};
-#endif
-
 #ifndef __ISPC_STRUCT_Material__
 #define __ISPC_STRUCT_Material__
 struct Material {
@@ -200,6 +201,15 @@ struct HittableList {
 };
 #endif
 
+#ifndef __ISPC_STRUCT_RenderOptions__
+#define __ISPC_STRUCT_RenderOptions__
+struct RenderOptions {
+    uint32_t batchSize;
+    enum RaySort raySort;
+    uint32_t rayMemoryMB;
+};
+#endif
+
 
 ///////////////////////////////////////////////////////////////////////////
 // Functions exported from ispc code
@@ -233,9 +243,9 @@ extern "C" {
     extern void initialize(struct Camera *cam);
 #endif // initialize function declaraion
 #if defined(__cplusplus)
-    extern void renderImage(struct Image &image, struct Camera &cam, struct HittableList &hittables);
+    extern void renderImage(struct Image &image, struct Camera &cam, struct HittableList &hittables, const struct RenderOptions &options);
 #else
-    extern void renderImage(struct Image *image, struct Camera *cam, struct HittableList *hittables);
+    extern void renderImage(struct Image *image, struct Camera *cam, struct HittableList *hittables, const struct RenderOptions *options);
 #endif // renderImage function declaraion
 #if defined(__cplusplus) && (! defined(__ISPC_NO_EXTERN_C) || !__ISPC_NO_EXTERN_C )
 } /* end extern C */
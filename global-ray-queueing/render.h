@@ -1,5 +1,24 @@
 #pragma once
+#include <chrono>
+#include <iomanip>
+#include <iostream>
 
+// Batching, ray order and ray memory of the queueing renderer
+struct RenderSettings {
+    ispc::RenderOptions options = {0, ispc::RaySort::NO_SORT, 256};
+    bool sortBenchmark = false; // Also time every ray order at several batch sizes
+};
+
+const char* raySortName(ispc::RaySort raySort) {
+    switch (raySort) {
+    case ispc::RaySort::OCTANT_SORT:
+        return "octant";
+    case ispc::RaySort::MORTON_SORT:
+        return "morton";
+    default:
+        return "none";
+    }
+}
 
 void writePPMImage(ispc::Image& image, int width, int height, const char* filename) {
     FILE* fp = fopen(filename, "wb");
@@ -16,24 +35,53 @@ void writePPMImage(ispc::Image& image, int width, int height, const char* filena
 }
 
 
+// Renders the scene unsorted and with each ray sort at several batch sizes, so the times show from
+// which batch size on sorting pays for itself. A batch size of 0 traces all the rays of a task at once,
+// or as many as the ray memory budget allows.
+void benchmarkRaySort(ispc::Image& image, ispc::Camera* camera, ispc::HittableList* hittableList,
+                      uint32_t rayMemoryMB) {
+    const uint32_t batchSizes[] = {1024, 4096, 16384, 65536, 0};
+    const ispc::RaySort raySorts[] = {ispc::RaySort::NO_SORT, ispc::RaySort::OCTANT_SORT, ispc::RaySort::MORTON_SORT};
+
+    std::cout << "Ray sort benchmark (milliseconds)" << std::endl;
+    std::cout << std::setw(12) << "batch size";
+    for (ispc::RaySort raySort : raySorts) {
+        std::cout << std::setw(10) << raySortName(raySort);
+    }
+    std::cout << std::endl;
+
+    for (uint32_t batchSize : batchSizes) {
+        std::cout << std::setw(12) << batchSize;
+        for (ispc::RaySort raySort : raySorts) {
+            ispc::RenderOptions options = {batchSize, raySort, rayMemoryMB};
+            auto start = std::chrono::high_resolution_clock::now();
+            ispc::renderImage(image, *camera, *hittableList, options);
+            auto end = std::chrono::high_resolution_clock::now();
+            std::cout << std::setw(10) << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+        }
+        std::cout << std::endl;
+    }
+}
+
 // Render scene
 
-void render(ispc::Camera* camera, ispc::HittableList* hittableList, bool usePackets) {
+void render(ispc::Camera* camera, ispc::HittableList* hittableList, bool usePackets,
+            const RenderSettings& renderSettings) {
     ispc::Image image;
     image.R = new int[camera->imageWidth * camera->imageHeight];
     image.G = new int[camera->imageWidth * camera->imageHeight];
     image.B = new int[camera->imageWidth * camera->imageHeight];
 
-    std::chrono::steady_clock::time_point start;
-    std::chrono::steady_clock::time_point end;
+    std::chrono::high_resolution_clock::time_point start;
+    std::chrono::high_resolution_clock::time_point end;
     std::cout << "Rendering image..." << std::endl;
     if (usePackets) {
         start = std::chrono::high_resolution_clock::now();
-        ispc::renderImage(image, *camera, *hittableList);
+        ispc::renderImage(image, *camera, *hittableList, renderSettings.options);
         end = std::chrono::high_resolution_clock::now();
     } else {
         start = std::chrono::high_resolution_clock::now();
-        ispc::renderImage(image, *camera, *hittableList);
+        ispc::renderImage(image, *camera, *hittableList, renderSettings.options);
         end = std::chrono::high_resolution_clock::now();
     }
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
@@ -41,6 +89,10 @@ void render(ispc::Camera* camera, ispc::HittableList* hittableList, bool usePack
 
     writePPMImage(image, camera->imageWidth, camera->imageHeight, "image.ppm");
 
+    if (renderSettings.sortBenchmark) {
+        benchmarkRaySort(image, camera, hittableList, renderSettings.options.rayMemoryMB);
+    }
+
     delete[] image.R;
     delete[] image.G;
     delete[] image.B;
@@ -49,6 +49,7 @@ ispc::HittableList* createHittableList(std::vector<ispc::Hittable>& objects) {
     ispc::HittableList* hittableList = new ispc::HittableList;
     hittableList->objects = objects.data();
     hittableList->numObjects = objects.size();
+    hittableList->bbox = emptyAABB(); // Grown by every object below; the ray sort quantizes against it
 
     for (size_t i = 0; i < objects.size(); i++) {
         switch (objects[i].type) {
@@ -86,9 +87,7 @@ ispc::HittableList* createHittableList(ispc::Hittable object) {
 
     hittableList->objects = objs;
     hittableList->numObjects = 1;
-
-    auto bbox = getAABB(object);
-    hittableList->bbox = createAABB(hittableList->bbox, bbox);
+    hittableList->bbox = getAABB(object);
 
     return hittableList;
 }
@@ -5,7 +5,7 @@
 // Scenes
 
 void randomSpheres(int imageWidth, int samplesPerPixel, int maxDepth, float vfov, bool useBVH, int bvhMaxLeafSize, bool usePackets,
-                   int numSpheres = 11, float zoom = 3.0f) {
+                   const RenderSettings& renderSettings, int numSpheres = 11, float zoom = 3.0f) {
     vfov = 20; // constant for random spheres
 
     auto lookfrom = ispc::float3{13, 2, zoom};
@@ -83,10 +83,11 @@ void randomSpheres(int imageWidth, int samplesPerPixel, int maxDepth, float vfov
         hittableList = createHittableList(objects);
     }
 
-    render(camera, hittableList, usePackets);
+    render(camera, hittableList, usePackets, renderSettings);
 }
 
-void cornellBox(int imageWidth, int samplesPerPixel, int maxDepth, float vfov, bool useBVH, int bvhMaxLeafSize, bool usePackets) {
+void cornellBox(int imageWidth, int samplesPerPixel, int maxDepth, float vfov, bool useBVH, int bvhMaxLeafSize, bool usePackets,
+                const RenderSettings& renderSettings) {
     vfov = 40; // constant for cornell box
 
     auto lookfrom = ispc::float3{278, 278, -800};
@@ -149,5 +150,5 @@ void cornellBox(int imageWidth, int samplesPerPixel, int maxDepth, float vfov, b
         hittableList = createHittableList(objects);
     }
 
-    render(camera, hittableList, usePackets);
+    render(camera, hittableList, usePackets, renderSettings);
 }
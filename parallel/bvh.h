@@ -1,11 +1,31 @@
 #pragma once
 
 #include "raytracer.h"
+#include "taskUtils.h"
 #include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cfloat>
 #include <chrono>
 #include <iostream>
 #include <limits>
+#include <vector>
+
+// Scene references (see raytracer.ispc). The base stays 0, so a reference is the address of what it
+// refers to, unless a snapshot was mapped.
+int64_t sceneBase = 0;
+
+template <typename T>
+T* sceneObject(int64_t ref) {
+    return (T*)(sceneBase + ref);
+}
+
+int64_t sceneRef(const void* object) { return (int64_t)object - sceneBase; }
+
+void useSceneBase(int64_t base) {
+    sceneBase = base;
+    ispc::setSceneBase(base);
+}
 
 ispc::float3 add(ispc::float3 a, ispc::float3 b) {
     ispc::float3 c;
@@ -46,23 +66,56 @@ ispc::aabb padAABB(ispc::aabb a) {
     return ispc::aabb{newX, newY, newZ};
 }
 
+ispc::float3 meshVertex(const ispc::TriangleMesh& mesh, uint32_t vertex) {
+    return ispc::float3{sceneObject<float>(mesh.x)[vertex], sceneObject<float>(mesh.y)[vertex],
+                        sceneObject<float>(mesh.z)[vertex]};
+}
+
+// Padded like the quad's box, as a triangle in an axis plane has no extent on that axis.
+ispc::aabb triangleAABB(const ispc::Triangle& triangle) {
+    const ispc::TriangleMesh& mesh = *sceneObject<ispc::TriangleMesh>(triangle.mesh);
+    const uint32_t* indices = sceneObject<uint32_t>(mesh.indices) + 3 * triangle.index;
+    ispc::aabb bbox = createAABB(meshVertex(mesh, indices[0]), meshVertex(mesh, indices[1]));
+    ispc::float3 c = meshVertex(mesh, indices[2]);
+    return padAABB(createAABB(bbox, createAABB(c, c)));
+}
+
 ispc::aabb getAABB(const ispc::Hittable& object) {
     switch (object.type) {
     case ispc::HittableType::SPHERE: {
-        ispc::Sphere* sphere = (ispc::Sphere*)object.object;
+        ispc::Sphere* sphere = sceneObject<ispc::Sphere>(object.object);
         return sphere->bbox;
     }
     case ispc::HittableType::NODE: {
-        ispc::Node* node = (ispc::Node*)object.object;
+        ispc::Node* node = sceneObject<ispc::Node>(object.object);
         return node->bbox;
     }
     case ispc::HittableType::QUAD: {
-        ispc::Quad* quad = (ispc::Quad*)object.object;
+        ispc::Quad* quad = sceneObject<ispc::Quad>(object.object);
         return quad->bbox;
     }
+    case ispc::HittableType::TRIANGLE:
+        return triangleAABB(*sceneObject<ispc::Triangle>(object.object));
     case ispc::HittableType::BVH: {
-        ispc::Bvh* bvh = (ispc::Bvh*)object.object;
-        return bvh->nodes[bvh->root].bbox;
+        ispc::Bvh* bvh = sceneObject<ispc::Bvh>(object.object);
+        return sceneObject<ispc::Node>(bvh->nodes)[bvh->root].bbox;
+    }
+    case ispc::HittableType::WIDE_BVH: {
+        ispc::WideBvh* bvh = sceneObject<ispc::WideBvh>(object.object);
+        return bvh->bbox;
+    }
+    case ispc::HittableType::COMPACT_BVH: {
+        ispc::CompactBvh* bvh = sceneObject<ispc::CompactBvh>(object.object);
+        ispc::CompactNode& root = sceneObject<ispc::CompactNode>(bvh->nodes)[0];
+        return createAABB(ispc::float3{root.minX, root.minY, root.minZ}, ispc::float3{root.maxX, root.maxY, root.maxZ});
+    }
+    case ispc::HittableType::INSTANCE: {
+        ispc::Instance* instance = sceneObject<ispc::Instance>(object.object);
+        return instance->bbox;
+    }
+    case ispc::HittableType::QUANTIZED_BVH: {
+        ispc::QuantizedBvh* bvh = sceneObject<ispc::QuantizedBvh>(object.object);
+        return bvh->bbox;
     }
     }
 }
@@ -80,32 +133,93 @@ ispc::interval getAxis(ispc::aabb bbox, int axis) {
     return bbox.x;
 }
 
-size_t newNode(std::vector<ispc::Node>& nodes, ispc::aabb box, size_t start, size_t size, size_t left, size_t right) {
-    ispc::Node node;
-    node.bbox = box;
-    node.start = start;
-    node.size = size;
-    node.left = left;
-    node.right = right;
-    nodes.push_back(node);
-    return nodes.size() - 1;
+// Build options
+
+enum class BvhBuilder {
+    SAH,      // Top-down binned SAH
+    LBVH,     // Morton-code linear BVH
+    LBVH_SAH, // Linear BVH with the top levels rebuilt by binned SAH
+    SBVH,     // Binned SAH with spatial splits and reference duplication
+};
+
+const char* bvhBuilderName(BvhBuilder builder) {
+    switch (builder) {
+    case BvhBuilder::LBVH:
+        return "lbvh";
+    case BvhBuilder::LBVH_SAH:
+        return "lbvh-sah";
+    case BvhBuilder::SBVH:
+        return "sbvh";
+    default:
+        return "sah";
+    }
+}
+
+struct BvhOptions {
+    bool enabled;
+    uint32_t maxLeafSize;
+    BvhBuilder builder;
+    uint32_t width; // 2 traverses the binary tree, 4 or 8 collapses it into WideNodes
+    bool compact;   // Flatten a binary tree into 32-byte depth-first CompactNodes
+    bool quantized; // Quantize a BVH8 (or BVH4) into QuantizedNodes with 8-bit child boxes
+    int optimizePasses; // Treelet restructuring passes after the build, 0 to skip
+    bool stats;         // Print a JSON report on every tree built and skip rendering
+    const char* snapshot; // Save the scene here once it is built, or nullptr
+    uint64_t snapshotKey; // Settings the scene is built with, see snapshotKey()
+    bool checkOcclusion;  // Compare occluded with closestHit on the camera's rays before rendering
+};
+
+// Wall clock time spent in each phase of a build, in milliseconds.
+struct BvhPhaseTimes {
+    std::vector<std::pair<const char*, double>> phases;
+    std::chrono::high_resolution_clock::time_point last = std::chrono::high_resolution_clock::now();
+};
+
+// Ends the phase that started at the previous mark. Builders are handed a null pointer when nobody
+// is timing them.
+void markPhase(BvhPhaseTimes* times, const char* name) {
+    if (times == nullptr) {
+        return;
+    }
+    auto now = std::chrono::high_resolution_clock::now();
+    times->phases.emplace_back(name, std::chrono::duration<double, std::milli>(now - times->last).count());
+    times->last = now;
 }
 
-ispc::aabb calculateBbox(std::vector<ispc::Hittable>& objects, size_t left, size_t right) {
-    auto start = objects.begin() + left;
-    auto end = objects.begin() + right;
+// Binned SAH construction
+
+const int bvhNumBins = 16;
+const float bvhTraversalCost = 1.0f;
+const float bvhIntersectionCost = 1.0f;
+
+// Entries in the stacks of the binary traversals (BVH_STACK_SIZE and COMPACT_BVH_STACK_SIZE in
+// raytracer.ispc). They push at most one entry per inner node on the path to a leaf, so no tree
+// may be deeper than this.
+const uint32_t bvhStackSize = 128;
+
+// Primitive reference used during construction. The builder works on these instead of the
+// hittables themselves so that bounding boxes are read through the void* once per primitive.
+struct PrimitiveRef {
+    ispc::aabb bbox;
+    ispc::float3 centroid;
+    uint32_t index;
+};
+
+struct Bin {
+    ispc::aabb bbox;
+    uint32_t count;
+};
+
+ispc::aabb emptyAABB() {
     ispc::aabb box;
     box.x = ispc::interval{FLT_MAX, -FLT_MAX};
     box.y = ispc::interval{FLT_MAX, -FLT_MAX};
     box.z = ispc::interval{FLT_MAX, -FLT_MAX};
-    for (auto it = start; it != end; it++) {
-        ispc::Hittable hittable = *it;
-        box = createAABB(box, getAABB(hittable));
-    }
-
     return box;
 }
 
+ispc::aabb growAABB(ispc::aabb box, ispc::float3 p) { return createAABB(box, createAABB(p, p)); }
+
 ispc::float3 center(ispc::aabb box) {
     return ispc::float3{(box.x.min + box.x.max) / 2.0f, (box.y.min + box.y.max) / 2.0f, (box.z.min + box.z.max) / 2.0f};
 }
@@ -117,78 +231,318 @@ float surfaceArea(ispc::aabb box) {
     return 2.0f * (x * y + y * z + z * x);
 }
 
-float calculateSAH(std::vector<ispc::Hittable>& objects, size_t left, size_t right, int axis, float split, float sc) {
-    auto start = objects.begin() + left;
-    auto end = objects.begin() + right;
+void writeNode(std::vector<ispc::Node>& nodes, size_t index, ispc::aabb box, size_t start, size_t size, size_t left,
+               size_t right) {
+    ispc::Node& node = nodes[index];
+    node.bbox = box;
+    node.start = start;
+    node.size = size;
+    node.left = left;
+    node.right = right;
+}
+
+// Ranges at least this large are split across tasks: subtrees are built concurrently and the
+// bounds and binning passes over a range are chunked.
+const size_t bvhParallelSubtreeSize = 4096;
+const size_t bvhParallelBinningSize = 1 << 16;
+const size_t bvhTaskChunkSize = 1 << 14;
+const int bvhMaxTasks = 64;
+
+std::vector<PrimitiveRef> createPrimitiveRefs(const std::vector<ispc::Hittable>& objects) {
+    std::vector<PrimitiveRef> refs(objects.size());
+    parallelChunks(objects.size(), bvhTaskChunkSize, bvhMaxTasks, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; i++) {
+            refs[i].bbox = getAABB(objects[i]);
+            refs[i].centroid = center(refs[i].bbox);
+            refs[i].index = i;
+        }
+    });
+    return refs;
+}
+
+struct Bounds {
+    ispc::aabb bbox;
+    ispc::aabb centroidBox;
+};
 
-    auto predicate = [&split, &axis](ispc::Hittable& obj) { return center(getAABB(obj)).v[axis] < split; };
+Bounds emptyBounds() { return Bounds{emptyAABB(), emptyAABB()}; }
 
-    auto middle = std::partition(start, end, predicate);
-    size_t middleIndex = middle - objects.begin();
+Bounds mergeBounds(const Bounds& a, const Bounds& b) {
+    return Bounds{createAABB(a.bbox, b.bbox), createAABB(a.centroidBox, b.centroidBox)};
+}
 
-    size_t nA = middleIndex - left;
-    size_t nB = right - middleIndex;
+Bounds computeBounds(const std::vector<PrimitiveRef>& refs, size_t start, size_t end) {
+    Bounds bounds = emptyBounds();
+    for (size_t i = start; i < end; i++) {
+        bounds.bbox = createAABB(bounds.bbox, refs[i].bbox);
+        bounds.centroidBox = growAABB(bounds.centroidBox, refs[i].centroid);
+    }
+    return bounds;
+}
 
-    auto bboxA = calculateBbox(objects, left, middleIndex);
-    float sA = surfaceArea(bboxA) / sc;
+Bounds computeBoundsParallel(const std::vector<PrimitiveRef>& refs, size_t start, size_t end) {
+    if (end - start < bvhParallelBinningSize) {
+        return computeBounds(refs, start, end);
+    }
 
-    auto bboxB = calculateBbox(objects, middleIndex, right);
-    float sB = surfaceArea(bboxB) / sc;
+    std::vector<Bounds> partial(bvhMaxTasks, emptyBounds());
+    int chunks = parallelChunks(end - start, bvhTaskChunkSize, bvhMaxTasks, [&](size_t begin, size_t chunkEnd, int task) {
+        partial[task] = computeBounds(refs, start + begin, start + chunkEnd);
+    });
 
-    return sA * nA + sB * nB;
+    Bounds bounds = emptyBounds();
+    for (int i = 0; i < chunks; i++) {
+        bounds = mergeBounds(bounds, partial[i]);
+    }
+    return bounds;
 }
 
-size_t constructBVH(std::vector<ispc::Hittable>& objects, std::vector<ispc::Node>& nodes, size_t start, size_t end, const uint32_t maxLeafSize) {
-    size_t size = end - start;
+int binIndex(float c, float min, float scale) {
+    int bin = (int)((c - min) * scale);
+    return std::clamp(bin, 0, bvhNumBins - 1);
+}
 
-    if (size <= maxLeafSize) {
-        return newNode(nodes, calculateBbox(objects, start, end), start, size, 0, 0);
+struct BinGrid {
+    float min[3];
+    float scale[3];
+};
+
+BinGrid createBinGrid(ispc::aabb centroidBox) {
+    BinGrid grid;
+    for (int axis = 0; axis < 3; axis++) {
+        ispc::interval extent = getAxis(centroidBox, axis);
+        grid.min[axis] = extent.min;
+        grid.scale[axis] = intervalSize(extent) > 0.0f ? bvhNumBins / intervalSize(extent) : 0.0f;
     }
+    return grid;
+}
 
-    const int numPartitions = 10;
+struct BinSet {
+    Bin bins[3][bvhNumBins];
+};
 
-    auto currentBbox = calculateBbox(objects, start, end);
-    float sa = surfaceArea(currentBbox);
+void clearBins(BinSet& set) {
+    for (int axis = 0; axis < 3; axis++) {
+        for (int b = 0; b < bvhNumBins; b++) {
+            set.bins[axis][b].bbox = emptyAABB();
+            set.bins[axis][b].count = 0;
+        }
+    }
+}
+
+// Bins the centroids of refs[start, end) on all three axes in a single pass.
+void binRefs(const std::vector<PrimitiveRef>& refs, size_t start, size_t end, const BinGrid& grid, BinSet& set) {
+    for (size_t i = start; i < end; i++) {
+        const PrimitiveRef& ref = refs[i];
+        for (int axis = 0; axis < 3; axis++) {
+            Bin& bin = set.bins[axis][binIndex(ref.centroid.v[axis], grid.min[axis], grid.scale[axis])];
+            bin.bbox = createAABB(bin.bbox, ref.bbox);
+            bin.count++;
+        }
+    }
+}
 
-    float bestSAH = std::numeric_limits<float>::max();
-    int bestAxis = 0;
-    float bestSplit = 0.0f;
+struct Split {
+    float cost;
+    int axis;
+    int bin;
+};
 
+// Sweeps the bins for the cheapest SAH split. Returns a split with axis -1 if the centroids
+// cannot be separated.
+Split sweepBins(const BinSet& set, const BinGrid& grid, float parentArea) {
+    Split best = {std::numeric_limits<float>::max(), -1, 0};
     for (int axis = 0; axis < 3; axis++) {
-        float min = getAxis(currentBbox, axis).min;
-        float max = getAxis(currentBbox, axis).max;
-        float range = max - min;
-        for (int i = 1; i <= numPartitions; i++) {
-            float split = min + range * ((float)i / (float)numPartitions);
-            float SAH = calculateSAH(objects, start, end, axis, split, sa);
-
-            if (SAH < bestSAH) {
-                bestSAH = SAH;
-                bestAxis = axis;
-                bestSplit = split;
+        if (grid.scale[axis] == 0.0f) {
+            continue;
+        }
+        const Bin* bins = set.bins[axis];
+
+        // Sweep from the right to get the area and count of everything above each split plane.
+        float rightArea[bvhNumBins];
+        uint32_t rightCount[bvhNumBins];
+        ispc::aabb box = emptyAABB();
+        uint32_t count = 0;
+        for (int b = bvhNumBins - 1; b > 0; b--) {
+            box = createAABB(box, bins[b].bbox);
+            count += bins[b].count;
+            rightArea[b] = surfaceArea(box);
+            rightCount[b] = count;
+        }
+
+        // Sweep from the left, splitting between bin b - 1 and bin b.
+        box = emptyAABB();
+        count = 0;
+        for (int b = 1; b < bvhNumBins; b++) {
+            box = createAABB(box, bins[b - 1].bbox);
+            count += bins[b - 1].count;
+            if (count == 0 || rightCount[b] == 0) {
+                continue;
+            }
+            float cost = bvhTraversalCost +
+                         bvhIntersectionCost * (surfaceArea(box) * count + rightArea[b] * rightCount[b]) / parentArea;
+            if (cost < best.cost) {
+                best = {cost, axis, b};
             }
         }
     }
 
-    auto bestPredicate = [&bestSplit, &bestAxis](ispc::Hittable& obj) {
-        return center(getAABB(obj)).v[bestAxis] < bestSplit;
-    };
+    return best;
+}
 
-    auto middle = std::partition(objects.begin() + start, objects.begin() + end, bestPredicate);
-    size_t middleIndex = middle - objects.begin();
+Split findBinnedSplit(const std::vector<PrimitiveRef>& refs, size_t start, size_t end, const Bounds& bounds) {
+    BinGrid grid = createBinGrid(bounds.centroidBox);
+    BinSet set;
+    clearBins(set);
+
+    if (end - start < bvhParallelBinningSize) {
+        binRefs(refs, start, end, grid, set);
+    } else {
+        std::vector<BinSet> partial(bvhMaxTasks);
+        int chunks = parallelChunks(end - start, bvhTaskChunkSize, bvhMaxTasks, [&](size_t begin, size_t chunkEnd, int task) {
+            clearBins(partial[task]);
+            binRefs(refs, start + begin, start + chunkEnd, grid, partial[task]);
+        });
+        for (int i = 0; i < chunks; i++) {
+            for (int axis = 0; axis < 3; axis++) {
+                for (int b = 0; b < bvhNumBins; b++) {
+                    Bin& bin = set.bins[axis][b];
+                    bin.bbox = createAABB(bin.bbox, partial[i].bins[axis][b].bbox);
+                    bin.count += partial[i].bins[axis][b].count;
+                }
+            }
+        }
+    }
 
-    size_t left = constructBVH(objects, nodes, start, middleIndex, maxLeafSize);
-    size_t right = constructBVH(objects, nodes, middleIndex, end, maxLeafSize);
+    return sweepBins(set, grid, surfaceArea(bounds.bbox));
+}
 
-    return newNode(nodes, currentBbox, start, size, left, right);
+// Shared state of one build. Nodes go into a preallocated array (a binary tree over n primitives
+// has at most 2n - 1 nodes); sibling pairs are reserved with a single atomic add so concurrent
+// subtree tasks never resize it.
+struct BuildContext {
+    std::vector<PrimitiveRef>& refs;
+    std::vector<ispc::Node>& nodes;
+    std::atomic<uint32_t> nodeCount;
+    uint32_t maxLeafSize;
+};
+
+void constructBVH(BuildContext& ctx, size_t nodeIndex, size_t start, size_t end, const Bounds& bounds,
+                  uint32_t depth) {
+    size_t size = end - start;
+
+    if (size == 1) {
+        writeNode(ctx.nodes, nodeIndex, bounds.bbox, start, size, 0, 0);
+        return;
+    }
+
+    Split split = findBinnedSplit(ctx.refs, start, end, bounds);
+
+    // Make a leaf when intersecting everything is no more expensive than the best split. The
+    // maximum leaf size still forces a split so leaves stay bounded for the traversal.
+    float leafCost = bvhIntersectionCost * size;
+    if (size <= ctx.maxLeafSize && (split.axis < 0 || leafCost <= split.cost)) {
+        writeNode(ctx.nodes, nodeIndex, bounds.bbox, start, size, 0, 0);
+        return;
+    }
+
+    size_t middleIndex;
+    if (depth + std::bit_width(size - 1) >= bvhStackSize) {
+        // Only a balanced subtree still fits under the depth limit, so halve the range at the median
+        // centroid along the widest axis.
+        int axis = 0;
+        for (int a = 1; a < 3; a++) {
+            if (intervalSize(getAxis(bounds.centroidBox, a)) > intervalSize(getAxis(bounds.centroidBox, axis))) {
+                axis = a;
+            }
+        }
+        middleIndex = start + size / 2;
+        std::nth_element(ctx.refs.begin() + start, ctx.refs.begin() + middleIndex, ctx.refs.begin() + end,
+                         [&](const PrimitiveRef& a, const PrimitiveRef& b) {
+                             return a.centroid.v[axis] < b.centroid.v[axis];
+                         });
+    } else if (split.axis < 0) {
+        // All centroids coincide, so any split is as good as another.
+        middleIndex = start + size / 2;
+    } else {
+        ispc::interval extent = getAxis(bounds.centroidBox, split.axis);
+        float scale = bvhNumBins / intervalSize(extent);
+        auto predicate = [&](const PrimitiveRef& ref) {
+            return binIndex(ref.centroid.v[split.axis], extent.min, scale) < split.bin;
+        };
+        auto middle = std::partition(ctx.refs.begin() + start, ctx.refs.begin() + end, predicate);
+        middleIndex = middle - ctx.refs.begin();
+    }
+
+    size_t left = ctx.nodeCount.fetch_add(2);
+    size_t right = left + 1;
+    writeNode(ctx.nodes, nodeIndex, bounds.bbox, start, size, left, right);
+
+    if (size < bvhParallelSubtreeSize) {
+        constructBVH(ctx, left, start, middleIndex, computeBounds(ctx.refs, start, middleIndex), depth + 1);
+        constructBVH(ctx, right, middleIndex, end, computeBounds(ctx.refs, middleIndex, end), depth + 1);
+        return;
+    }
+
+    launchTasks(2, [&](int child, int) {
+        size_t childStart = child == 0 ? start : middleIndex;
+        size_t childEnd = child == 0 ? middleIndex : end;
+        constructBVH(ctx, child == 0 ? left : right, childStart, childEnd,
+                     computeBoundsParallel(ctx.refs, childStart, childEnd), depth + 1);
+    });
+}
+
+// Inner nodes on the longest path from nodeIndex down to a leaf.
+uint32_t bvhDepth(const std::vector<ispc::Node>& nodes, uint32_t nodeIndex) {
+    const ispc::Node& node = nodes[nodeIndex];
+    if (node.left == node.right) {
+        return 0;
+    }
+    return 1 + std::max(bvhDepth(nodes, node.left), bvhDepth(nodes, node.right));
 }
 
-ispc::Bvh* createBVH(std::vector<ispc::Hittable>& objects, std::vector<ispc::Node>& nodes, const uint32_t maxLeafSize) {
+// Puts the hittables in the order of the references, so the contiguous ranges the leaves index
+// into match, and fills in the Bvh that the kernels traverse.
+ispc::Bvh* finishBVH(std::vector<ispc::Hittable>& objects, std::vector<ispc::Node>& nodes,
+                     const std::vector<PrimitiveRef>& refs) {
+    std::vector<ispc::Hittable> ordered(refs.size());
+    parallelChunks(refs.size(), bvhTaskChunkSize, bvhMaxTasks, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; i++) {
+            ordered[i] = objects[refs[i].index];
+        }
+    });
+    objects.swap(ordered);
+
     ispc::Bvh* bvh = new ispc::Bvh;
-    bvh->objects = objects.data();
+    bvh->objects = sceneRef(objects.data());
     bvh->numObjects = objects.size();
-    bvh->root = constructBVH(objects, nodes, 0, objects.size(), maxLeafSize);
-    bvh->nodes = nodes.data();
+    bvh->nodes = sceneRef(nodes.data());
+    bvh->leaves = 0;
+    bvh->spheres = 0;
+    bvh->quads = 0;
+    bvh->sphereBlocks = 0;
+    bvh->quadBlocks = 0;
     bvh->numNodes = nodes.size();
+    bvh->root = 0;
+    bvh->numSpheres = 0;
+    bvh->numQuads = 0;
+    bvh->numSphereBlocks = 0;
+    bvh->numQuadBlocks = 0;
+    return bvh;
+}
+
+ispc::Bvh* createBVH(std::vector<ispc::Hittable>& objects, std::vector<ispc::Node>& nodes, const uint32_t maxLeafSize,
+                     BvhPhaseTimes* times = nullptr) {
+    std::vector<PrimitiveRef> refs = createPrimitiveRefs(objects);
+    markPhase(times, "refs");
+
+    nodes.resize(std::max<size_t>(2 * refs.size(), 2) - 1);
+    BuildContext ctx{refs, nodes, {1}, std::max(maxLeafSize, 1u)};
+    constructBVH(ctx, 0, 0, refs.size(), computeBoundsParallel(refs, 0, refs.size()), 0);
+    nodes.resize(ctx.nodeCount);
+    markPhase(times, "construct");
+
+    ispc::Bvh* bvh = finishBVH(objects, nodes, refs);
+    markPhase(times, "reorder");
     return bvh;
 }
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "bvh.h"
+#include "optimizeBvh.h"
+#include "raytracer.h"
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+// Quality report on a built binary BVH, for tuning the builders and the leaf size without rendering
+
+struct BvhStats {
+    size_t numNodes;
+    size_t numLeaves;
+    std::vector<uint32_t> depthHistogram;    // Leaves at each depth, the root being depth 0
+    std::vector<uint32_t> leafSizeHistogram; // Leaves holding each number of primitives
+    float sahCost;
+    double siblingOverlap;      // Mean volume shared by the boxes of the two children of an inner node
+    double siblingOverlapRatio; // The same relative to the volume of the parent
+    size_t nodeBytes;
+    size_t objectBytes;
+};
+
+double volume(ispc::aabb box) {
+    return std::max(0.0, (double)intervalSize(box.x)) * std::max(0.0, (double)intervalSize(box.y)) *
+           std::max(0.0, (double)intervalSize(box.z));
+}
+
+double overlapVolume(ispc::aabb a, ispc::aabb b) {
+    double x = std::min(a.x.max, b.x.max) - std::max(a.x.min, b.x.min);
+    double y = std::min(a.y.max, b.y.max) - std::max(a.y.min, b.y.min);
+    double z = std::min(a.z.max, b.z.max) - std::max(a.z.min, b.z.min);
+    return std::max(x, 0.0) * std::max(y, 0.0) * std::max(z, 0.0);
+}
+
+void addToHistogram(std::vector<uint32_t>& histogram, size_t bucket) {
+    if (histogram.size() <= bucket) {
+        histogram.resize(bucket + 1);
+    }
+    histogram[bucket]++;
+}
+
+void collectStats(const std::vector<ispc::Node>& nodes, uint32_t nodeIndex, uint32_t depth, BvhStats& stats) {
+    const ispc::Node& node = nodes[nodeIndex];
+    stats.numNodes++;
+
+    if (node.left == node.right) {
+        stats.numLeaves++;
+        addToHistogram(stats.depthHistogram, depth);
+        addToHistogram(stats.leafSizeHistogram, node.size);
+        return;
+    }
+
+    double overlap = overlapVolume(nodes[node.left].bbox, nodes[node.right].bbox);
+    double parentVolume = volume(node.bbox);
+    stats.siblingOverlap += overlap;
+    stats.siblingOverlapRatio += parentVolume > 0.0 ? overlap / parentVolume : 0.0;
+
+    collectStats(nodes, node.left, depth + 1, stats);
+    collectStats(nodes, node.right, depth + 1, stats);
+}
+
+// Walks the tree from its root, so nodes a builder allocated but never linked are not counted.
+BvhStats computeBvhStats(const ispc::Bvh& bvh, const std::vector<ispc::Node>& nodes) {
+    BvhStats stats{};
+    collectStats(nodes, bvh.root, 0, stats);
+
+    size_t numInner = stats.numNodes - stats.numLeaves;
+    if (numInner > 0) {
+        stats.siblingOverlap /= numInner;
+        stats.siblingOverlapRatio /= numInner;
+    }
+    stats.sahCost = treeCost(nodes, bvh.root);
+    stats.nodeBytes = nodes.size() * sizeof(ispc::Node);
+    stats.objectBytes = bvh.numObjects * sizeof(ispc::Hittable);
+    return stats;
+}
+
+void printHistogram(std::ostream& out, const std::vector<uint32_t>& histogram) {
+    out << "[";
+    for (size_t i = 0; i < histogram.size(); i++) {
+        out << (i > 0 ? "," : "") << histogram[i];
+    }
+    out << "]";
+}
+
+// Prints the report as a single line of JSON, so it can be picked out of the rest of the output.
+void printBvhStats(std::ostream& out, const BvhStats& stats, const BvhOptions& options, const BvhPhaseTimes& times) {
+    out << "{\"builder\":\"" << bvhBuilderName(options.builder) << "\"";
+    out << ",\"maxLeafSize\":" << options.maxLeafSize;
+    out << ",\"optimizePasses\":" << options.optimizePasses;
+    out << ",\"nodes\":" << stats.numNodes;
+    out << ",\"leaves\":" << stats.numLeaves;
+    out << ",\"depthHistogram\":";
+    printHistogram(out, stats.depthHistogram);
+    out << ",\"leafSizeHistogram\":";
+    printHistogram(out, stats.leafSizeHistogram);
+    out << ",\"sahCost\":" << stats.sahCost;
+    out << ",\"siblingOverlap\":" << stats.siblingOverlap;
+    out << ",\"siblingOverlapRatio\":" << stats.siblingOverlapRatio;
+    out << ",\"memoryBytes\":{\"nodes\":" << stats.nodeBytes << ",\"objects\":" << stats.objectBytes
+        << ",\"total\":" << stats.nodeBytes + stats.objectBytes << "}";
+
+    double total = 0.0;
+    out << ",\"buildMilliseconds\":{";
+    for (size_t i = 0; i < times.phases.size(); i++) {
+        out << (i > 0 ? "," : "") << "\"" << times.phases[i].first << "\":" << times.phases[i].second;
+        total += times.phases[i].second;
+    }
+    out << (times.phases.empty() ? "" : ",") << "\"total\":" << total << "}}" << std::endl;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "bvh.h"
+#include "raytracer.h"
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+// Flattening a binary BVH into 32-byte depth-first CompactNodes
+
+const size_t cacheLineSize = 64;
+
+// Allocator that hands out storage aligned to a cache line, so a 32-byte node never straddles two
+// lines.
+template <typename T, size_t Alignment = cacheLineSize>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t n) { return (T*)::operator new(n * sizeof(T), std::align_val_t(Alignment)); }
+
+    void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(Alignment)); }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const {
+        return true;
+    }
+};
+
+using CompactNodes = std::vector<ispc::CompactNode, AlignedAllocator<ispc::CompactNode>>;
+
+static_assert(sizeof(ispc::CompactNode) == 32, "CompactNode should be half a cache line");
+
+uint32_t flattenNode(const std::vector<ispc::Node>& nodes, CompactNodes& compactNodes, uint32_t nodeIndex) {
+    uint32_t compactIndex = compactNodes.size();
+    compactNodes.emplace_back();
+
+    const ispc::Node& node = nodes[nodeIndex];
+    ispc::CompactNode compact;
+    compact.minX = node.bbox.x.min;
+    compact.minY = node.bbox.y.min;
+    compact.minZ = node.bbox.z.min;
+    compact.maxX = node.bbox.x.max;
+    compact.maxY = node.bbox.y.max;
+    compact.maxZ = node.bbox.z.max;
+
+    if (node.left == node.right) {
+        compact.offset = node.start;
+        compact.count = node.size;
+    } else {
+        flattenNode(nodes, compactNodes, node.left);
+        compact.offset = flattenNode(nodes, compactNodes, node.right);
+        compact.count = 0;
+    }
+
+    compactNodes[compactIndex] = compact;
+    return compactIndex;
+}
+
+// Lays the binary tree out depth first, so the left child of every inner node is the node right
+// after it and a whole left spine is read sequentially.
+ispc::CompactBvh* createCompactBVH(const ispc::Bvh& bvh, const std::vector<ispc::Node>& nodes,
+                                   CompactNodes& compactNodes) {
+    compactNodes.clear();
+    compactNodes.reserve(nodes.size());
+    flattenNode(nodes, compactNodes, bvh.root);
+
+    ispc::CompactBvh* compactBvh = new ispc::CompactBvh;
+    compactBvh->objects = bvh.objects;
+    compactBvh->numObjects = bvh.numObjects;
+    compactBvh->nodes = sceneRef(compactNodes.data());
+    compactBvh->numNodes = compactNodes.size();
+    return compactBvh;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "bvh.h"
+#include "raytracer.h"
+#include "taskUtils.h"
+#include <vector>
+
+// Refitting a BVH after objects move
+//
+// Moving objects keeps the tree topology valid, only the boxes go stale. Refitting recomputes them
+// bottom-up in a single pass, which is much cheaper than a rebuild, but the tree gets worse the
+// further objects move from where they were at build time. The SAH cost of the refit tree is
+// tracked against the cost right after the last build, and the tree is rebuilt once it has grown
+// past bvhRebuildThreshold.
+
+const float bvhRebuildThreshold = 1.5f;
+
+// Recomputes the boxes below nodeIndex and returns the (unnormalized) SAH cost of the subtree.
+// Inner nodes hold the number of primitives below them, which decides when to split across tasks.
+float refitNode(ispc::Bvh& bvh, uint32_t nodeIndex) {
+    ispc::Node* nodes = sceneObject<ispc::Node>(bvh.nodes);
+    ispc::Node& node = nodes[nodeIndex];
+
+    if (node.left == node.right) {
+        ispc::Hittable* objects = sceneObject<ispc::Hittable>(bvh.objects);
+        ispc::aabb box = emptyAABB();
+        for (uint32_t i = node.start; i < node.start + node.size; i++) {
+            box = createAABB(box, getAABB(objects[i]));
+        }
+        node.bbox = box;
+        return bvhIntersectionCost * node.size * surfaceArea(box);
+    }
+
+    float costs[2];
+    if (node.size < bvhParallelSubtreeSize) {
+        costs[0] = refitNode(bvh, node.left);
+        costs[1] = refitNode(bvh, node.right);
+    } else {
+        launchTasks(2, [&](int child, int) { costs[child] = refitNode(bvh, child == 0 ? node.left : node.right); });
+    }
+
+    node.bbox = createAABB(nodes[node.left].bbox, nodes[node.right].bbox);
+    return bvhTraversalCost * surfaceArea(node.bbox) + costs[0] + costs[1];
+}
+
+// Refits the whole tree and returns its SAH cost relative to the root box.
+float refitBVH(ispc::Bvh& bvh) {
+    float cost = refitNode(bvh, bvh.root);
+    float rootArea = surfaceArea(sceneObject<ispc::Node>(bvh.nodes)[bvh.root].bbox);
+    return rootArea > 0.0f ? cost / rootArea : cost;
+}
+
+// A BVH whose objects are moved in place between frames (see moveSphere and moveQuad).
+struct DynamicBvh {
+    std::vector<ispc::Hittable>& objects; // Ordered (and, for the SBVH, duplicated) objects
+    std::vector<ispc::Node>& nodes;
+    std::vector<ispc::Hittable> sourceObjects; // The objects as the scene created them, to rebuild from
+    ispc::Bvh* bvh;
+    BvhOptions options;
+    float builtCost;
+    float cost;
+    uint32_t rebuilds;
+};
+
+// Builds the initial tree. The costs are taken from a refit so later frames are compared like for
+// like: the SBVH's clipped leaf boxes do not survive a refit.
+DynamicBvh createDynamicBVH(std::vector<ispc::Hittable>& objects, std::vector<ispc::Node>& nodes,
+                            const BvhOptions& options) {
+    std::vector<ispc::Hittable> sourceObjects = objects;
+    ispc::Bvh* bvh = buildBVH(objects, nodes, options);
+    float cost = refitBVH(*bvh);
+    return DynamicBvh{objects, nodes, std::move(sourceObjects), bvh, options, cost, cost, 0};
+}
+
+// Brings the tree up to date with the objects' current positions. Returns true if it had to be
+// rebuilt, in which case nodes and objects were reallocated.
+bool updateDynamicBVH(DynamicBvh& dynamic) {
+    dynamic.cost = refitBVH(*dynamic.bvh);
+    if (dynamic.cost <= bvhRebuildThreshold * dynamic.builtCost) {
+        return false;
+    }
+
+    dynamic.objects = dynamic.sourceObjects;
+    ispc::Bvh* rebuilt = buildBVH(dynamic.objects, dynamic.nodes, dynamic.options);
+    *dynamic.bvh = *rebuilt;
+    delete rebuilt;
+
+    dynamic.builtCost = refitBVH(*dynamic.bvh);
+    dynamic.cost = dynamic.builtCost;
+    dynamic.rebuilds++;
+    return true;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "bvh.h"
+#include "raytracer.h"
+#include <cmath>
+
+// Two-level acceleration structure
+//
+// A bottom-level BVH (BLAS) is built once per unique piece of geometry, in its own object space.
+// Instances place a BLAS in the world with an affine transform, and the top-level BVH (TLAS) is a
+// regular BVH built over the instances' world boxes. Rays are moved into object space in
+// hitInstance, so any number of instances share the one BLAS.
+
+ispc::Affine identityAffine() {
+    return ispc::Affine{ispc::float3{1, 0, 0}, ispc::float3{0, 1, 0}, ispc::float3{0, 0, 1}, ispc::float3{0, 0, 0}};
+}
+
+ispc::Affine translateAffine(ispc::float3 offset) {
+    ispc::Affine t = identityAffine();
+    t.p = offset;
+    return t;
+}
+
+ispc::Affine scaleAffine(float s) {
+    return ispc::Affine{ispc::float3{s, 0, 0}, ispc::float3{0, s, 0}, ispc::float3{0, 0, s}, ispc::float3{0, 0, 0}};
+}
+
+ispc::Affine rotateYAffine(float radians) {
+    float c = std::cos(radians);
+    float s = std::sin(radians);
+    return ispc::Affine{ispc::float3{c, 0, -s}, ispc::float3{0, 1, 0}, ispc::float3{s, 0, c}, ispc::float3{0, 0, 0}};
+}
+
+ispc::float3 transformVector(const ispc::Affine& t, ispc::float3 v) {
+    ispc::float3 result;
+    for (int i = 0; i < 3; i++) {
+        result.v[i] = t.x.v[i] * v.v[0] + t.y.v[i] * v.v[1] + t.z.v[i] * v.v[2];
+    }
+    return result;
+}
+
+ispc::float3 transformPoint(const ispc::Affine& t, ispc::float3 p) { return add(transformVector(t, p), t.p); }
+
+// Returns a applied after b.
+ispc::Affine composeAffine(const ispc::Affine& a, const ispc::Affine& b) {
+    return ispc::Affine{transformVector(a, b.x), transformVector(a, b.y), transformVector(a, b.z), transformPoint(a, b.p)};
+}
+
+ispc::Affine invertAffine(const ispc::Affine& t) {
+    const float* x = t.x.v;
+    const float* y = t.y.v;
+    const float* z = t.z.v;
+
+    // Rows of the inverse of the linear part are the cross products of its columns.
+    ispc::float3 rows[3] = {
+        {y[1] * z[2] - y[2] * z[1], y[2] * z[0] - y[0] * z[2], y[0] * z[1] - y[1] * z[0]},
+        {z[1] * x[2] - z[2] * x[1], z[2] * x[0] - z[0] * x[2], z[0] * x[1] - z[1] * x[0]},
+        {x[1] * y[2] - x[2] * y[1], x[2] * y[0] - x[0] * y[2], x[0] * y[1] - x[1] * y[0]},
+    };
+    float invDet = 1.0f / (x[0] * rows[0].v[0] + x[1] * rows[0].v[1] + x[2] * rows[0].v[2]);
+
+    ispc::Affine inverse;
+    for (int i = 0; i < 3; i++) {
+        inverse.x.v[i] = rows[i].v[0] * invDet;
+        inverse.y.v[i] = rows[i].v[1] * invDet;
+        inverse.z.v[i] = rows[i].v[2] * invDet;
+    }
+    ispc::float3 p = transformVector(inverse, t.p);
+    inverse.p = ispc::float3{-p.v[0], -p.v[1], -p.v[2]};
+    return inverse;
+}
+
+// World box of an object space box: the box around its eight transformed corners.
+ispc::aabb transformAABB(const ispc::Affine& t, ispc::aabb box) {
+    ispc::aabb result = emptyAABB();
+    for (int corner = 0; corner < 8; corner++) {
+        ispc::float3 p = {(corner & 1) ? box.x.max : box.x.min, (corner & 2) ? box.y.max : box.y.min,
+                          (corner & 4) ? box.z.max : box.z.min};
+        result = growAABB(result, transformPoint(t, p));
+    }
+    return result;
+}
+
+ispc::Instance* createInstance(ispc::Hittable object, ispc::Affine objectToWorld) {
+    ispc::Instance* instance = new ispc::Instance;
+    instance->object = object;
+    instance->objectToWorld = objectToWorld;
+    instance->worldToObject = invertAffine(objectToWorld);
+    instance->bbox = transformAABB(objectToWorld, getAABB(object));
+    return instance;
+}
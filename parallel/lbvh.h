@@ -0,0 +1,366 @@
+#pragma once
+
+#include "bvh.h"
+#include <bit>
+
+// Linear BVH construction (Karras, "Maximizing Parallelism in the Construction of BVHs, Octrees,
+// and k-d Trees", HPG 2012). Primitives are sorted along a 30-bit Morton curve of their centroids
+// and every internal node of the resulting radix tree is found independently, so all passes are
+// flat parallel loops. The output uses the same Node layout as the SAH builder.
+
+const int lbvhRadixBits = 8;
+const int lbvhRadixBuckets = 1 << lbvhRadixBits;
+
+// Number of clusters the top of the tree is cut into when refining it with binned SAH.
+const size_t lbvhRefineClusters = 2048;
+
+// Spreads the low 10 bits of v so there are two zero bits between each of them.
+uint32_t expandBits(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+uint32_t mortonCode(ispc::float3 p, const BinGrid& grid) {
+    uint32_t code = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        // The bin grid scale maps the centroid box onto [0, bvhNumBins); rescale it to 10 bits.
+        float x = (p.v[axis] - grid.min[axis]) * grid.scale[axis] * (1024.0f / bvhNumBins);
+        uint32_t q = (uint32_t)std::clamp(x, 0.0f, 1023.0f);
+        code |= expandBits(q) << (2 - axis);
+    }
+    return code;
+}
+
+// Stable LSD radix sort of (Morton code << 32 | reference index) keys on the 30 code bits. Each pass
+// histograms contiguous chunks in parallel, prefix sums the histograms and scatters each chunk
+// into its own slots, so keys with equal codes keep their order.
+void radixSortMorton(std::vector<uint64_t>& keys) {
+    std::vector<uint64_t> scratch(keys.size());
+    std::vector<uint32_t> histograms(bvhMaxTasks * lbvhRadixBuckets);
+
+    for (int shift = 32; shift < 62; shift += lbvhRadixBits) {
+        std::fill(histograms.begin(), histograms.end(), 0);
+        int chunks = parallelChunks(keys.size(), bvhTaskChunkSize, bvhMaxTasks, [&](size_t begin, size_t end, int task) {
+            uint32_t* histogram = &histograms[task * lbvhRadixBuckets];
+            for (size_t i = begin; i < end; i++) {
+                histogram[(keys[i] >> shift) & (lbvhRadixBuckets - 1)]++;
+            }
+        });
+
+        // Turn the counts into starting offsets, bucket-major so chunks stay in order.
+        uint32_t offset = 0;
+        for (int bucket = 0; bucket < lbvhRadixBuckets; bucket++) {
+            for (int chunk = 0; chunk < chunks; chunk++) {
+                uint32_t count = histograms[chunk * lbvhRadixBuckets + bucket];
+                histograms[chunk * lbvhRadixBuckets + bucket] = offset;
+                offset += count;
+            }
+        }
+
+        parallelChunks(keys.size(), bvhTaskChunkSize, bvhMaxTasks, [&](size_t begin, size_t end, int task) {
+            uint32_t* offsets = &histograms[task * lbvhRadixBuckets];
+            for (size_t i = begin; i < end; i++) {
+                scratch[offsets[(keys[i] >> shift) & (lbvhRadixBuckets - 1)]++] = keys[i];
+            }
+        });
+        keys.swap(scratch);
+    }
+}
+
+// Radix tree produced by the Karras construction. Internal node i is entry i and leaf j (the j-th
+// sorted primitive) is entry numLeaves - 1 + j.
+struct RadixTree {
+    uint32_t numLeaves;
+    std::vector<uint32_t> left;
+    std::vector<uint32_t> right;
+    std::vector<uint32_t> first;
+    std::vector<uint32_t> last;
+    std::vector<uint32_t> parent;
+    std::vector<ispc::aabb> bbox;
+
+    bool isLeaf(uint32_t node) const { return node >= numLeaves - 1; }
+    uint32_t size(uint32_t node) const { return last[node] - first[node] + 1; }
+};
+
+// Length of the common prefix of the keys of sorted primitives i and j, or -1 if j is out of range.
+// Equal codes fall back to comparing the indices so every key is distinct.
+int commonPrefix(const std::vector<uint64_t>& keys, int i, int j) {
+    if (j < 0 || j >= (int)keys.size()) {
+        return -1;
+    }
+    uint32_t a = keys[i] >> 32;
+    uint32_t b = keys[j] >> 32;
+    if (a == b) {
+        return 32 + std::countl_zero((uint32_t)i ^ (uint32_t)j);
+    }
+    return std::countl_zero(a ^ b);
+}
+
+void buildRadixTree(RadixTree& tree, const std::vector<uint64_t>& keys) {
+    int numInternal = (int)tree.numLeaves - 1;
+
+    parallelChunks(numInternal, bvhTaskChunkSize, bvhMaxTasks, [&](size_t begin, size_t end, int) {
+        for (int i = (int)begin; i < (int)end; i++) {
+            // Direction of the range covered by node i, and its other end j.
+            int d = commonPrefix(keys, i, i + 1) > commonPrefix(keys, i, i - 1) ? 1 : -1;
+            int minPrefix = commonPrefix(keys, i, i - d);
+            int maxLength = 2;
+            while (commonPrefix(keys, i, i + maxLength * d) > minPrefix) {
+                maxLength *= 2;
+            }
+            int length = 0;
+            for (int step = maxLength / 2; step >= 1; step /= 2) {
+                if (commonPrefix(keys, i, i + (length + step) * d) > minPrefix) {
+                    length += step;
+                }
+            }
+            int j = i + length * d;
+
+            // Binary search for the position of the highest differing bit within the range.
+            int nodePrefix = commonPrefix(keys, i, j);
+            int split = 0;
+            int step = length;
+            do {
+                step = (step + 1) / 2;
+                if (commonPrefix(keys, i, i + (split + step) * d) > nodePrefix) {
+                    split += step;
+                }
+            } while (step > 1);
+            int gamma = i + split * d + std::min(d, 0);
+
+            uint32_t left = std::min(i, j) == gamma ? numInternal + gamma : gamma;
+            uint32_t right = std::max(i, j) == gamma + 1 ? numInternal + gamma + 1 : gamma + 1;
+            tree.left[i] = left;
+            tree.right[i] = right;
+            tree.first[i] = std::min(i, j);
+            tree.last[i] = std::max(i, j);
+            tree.parent[left] = i;
+            tree.parent[right] = i;
+        }
+    });
+}
+
+// Computes the internal boxes bottom-up. Each leaf walks towards the root; the first thread to
+// reach a node stops and the second one, which knows both children are done, merges them.
+void computeRadixTreeBounds(RadixTree& tree, const std::vector<PrimitiveRef>& refs,
+                            const std::vector<uint64_t>& keys) {
+    uint32_t numInternal = tree.numLeaves - 1;
+    std::vector<std::atomic<uint32_t>> visits(numInternal);
+    for (auto& v : visits) {
+        v.store(0, std::memory_order_relaxed);
+    }
+
+    parallelChunks(tree.numLeaves, bvhTaskChunkSize, bvhMaxTasks, [&](size_t begin, size_t end, int) {
+        for (size_t j = begin; j < end; j++) {
+            uint32_t node = numInternal + j;
+            tree.bbox[node] = refs[(uint32_t)keys[j]].bbox;
+            tree.first[node] = j;
+            tree.last[node] = j;
+
+            while (node != 0) {
+                node = tree.parent[node];
+                if (visits[node].fetch_add(1, std::memory_order_acq_rel) == 0) {
+                    break;
+                }
+                tree.bbox[node] = createAABB(tree.bbox[tree.left[node]], tree.bbox[tree.right[node]]);
+            }
+        }
+    });
+}
+
+struct LbvhContext {
+    const RadixTree& tree;
+    std::vector<ispc::Node>& nodes;
+    std::atomic<uint32_t> nodeCount;
+    uint32_t maxLeafSize;
+};
+
+// Copies the radix tree below treeNode into the output array, collapsing subtrees into leaves
+// where the SAH says a leaf is no more expensive. Primitive ranges are shifted by offset, which is
+// non-zero only when the SAH refinement has moved the subtree.
+void emitRadixTree(LbvhContext& ctx, uint32_t treeNode, size_t nodeIndex, int64_t offset) {
+    const RadixTree& tree = ctx.tree;
+    uint32_t size = tree.size(treeNode);
+    size_t start = tree.first[treeNode] + offset;
+    ispc::aabb bbox = tree.bbox[treeNode];
+
+    if (tree.isLeaf(treeNode)) {
+        writeNode(ctx.nodes, nodeIndex, bbox, start, size, 0, 0);
+        return;
+    }
+
+    uint32_t treeLeft = tree.left[treeNode];
+    uint32_t treeRight = tree.right[treeNode];
+    if (size <= ctx.maxLeafSize) {
+        float splitCost = bvhTraversalCost + bvhIntersectionCost *
+                                                 (surfaceArea(tree.bbox[treeLeft]) * tree.size(treeLeft) +
+                                                  surfaceArea(tree.bbox[treeRight]) * tree.size(treeRight)) /
+                                                 surfaceArea(bbox);
+        if (bvhIntersectionCost * size <= splitCost) {
+            writeNode(ctx.nodes, nodeIndex, bbox, start, size, 0, 0);
+            return;
+        }
+    }
+
+    size_t left = ctx.nodeCount.fetch_add(2);
+    size_t right = left + 1;
+    writeNode(ctx.nodes, nodeIndex, bbox, start, size, left, right);
+
+    if (size < bvhParallelSubtreeSize) {
+        emitRadixTree(ctx, treeLeft, left, offset);
+        emitRadixTree(ctx, treeRight, right, offset);
+        return;
+    }
+
+    launchTasks(2, [&](int child, int) {
+        emitRadixTree(ctx, child == 0 ? treeLeft : treeRight, child == 0 ? left : right, offset);
+    });
+}
+
+// Cuts the radix tree into clusters of at most clusterSize primitives, top-down.
+void collectClusters(const RadixTree& tree, uint32_t treeNode, uint32_t clusterSize, std::vector<uint32_t>& clusters) {
+    if (tree.isLeaf(treeNode) || tree.size(treeNode) <= clusterSize) {
+        clusters.push_back(treeNode);
+        return;
+    }
+    collectClusters(tree, tree.left[treeNode], clusterSize, clusters);
+    collectClusters(tree, tree.right[treeNode], clusterSize, clusters);
+}
+
+// Rebuilds the part of the tree above the clusters with binned SAH, treating every cluster as a
+// single primitive. Clusters are placed in the order the SAH leaves them in, starting at
+// primitive position primOffset, and their radix subtrees are emitted below.
+void constructClusterTree(LbvhContext& ctx, std::vector<PrimitiveRef>& clusterRefs, const std::vector<uint32_t>& clusters,
+                          std::vector<int64_t>& clusterOffsets, size_t nodeIndex, size_t start, size_t end,
+                          size_t primOffset) {
+    const RadixTree& tree = ctx.tree;
+    if (end - start == 1) {
+        uint32_t cluster = clusterRefs[start].index;
+        int64_t offset = (int64_t)primOffset - tree.first[clusters[cluster]];
+        clusterOffsets[cluster] = offset;
+        emitRadixTree(ctx, clusters[cluster], nodeIndex, offset);
+        return;
+    }
+
+    Bounds bounds = computeBounds(clusterRefs, start, end);
+    Split split = findBinnedSplit(clusterRefs, start, end, bounds);
+
+    size_t middleIndex;
+    if (split.axis < 0) {
+        middleIndex = start + (end - start) / 2;
+    } else {
+        ispc::interval extent = getAxis(bounds.centroidBox, split.axis);
+        float scale = bvhNumBins / intervalSize(extent);
+        auto predicate = [&](const PrimitiveRef& ref) {
+            return binIndex(ref.centroid.v[split.axis], extent.min, scale) < split.bin;
+        };
+        auto middle = std::partition(clusterRefs.begin() + start, clusterRefs.begin() + end, predicate);
+        middleIndex = middle - clusterRefs.begin();
+    }
+
+    size_t size = 0;
+    size_t leftSize = 0;
+    for (size_t i = start; i < end; i++) {
+        size += tree.size(clusters[clusterRefs[i].index]);
+        if (i < middleIndex) {
+            leftSize += tree.size(clusters[clusterRefs[i].index]);
+        }
+    }
+
+    size_t left = ctx.nodeCount.fetch_add(2);
+    size_t right = left + 1;
+    writeNode(ctx.nodes, nodeIndex, bounds.bbox, primOffset, size, left, right);
+
+    if (size < bvhParallelSubtreeSize) {
+        constructClusterTree(ctx, clusterRefs, clusters, clusterOffsets, left, start, middleIndex, primOffset);
+        constructClusterTree(ctx, clusterRefs, clusters, clusterOffsets, right, middleIndex, end, primOffset + leftSize);
+        return;
+    }
+
+    launchTasks(2, [&](int child, int) {
+        if (child == 0) {
+            constructClusterTree(ctx, clusterRefs, clusters, clusterOffsets, left, start, middleIndex, primOffset);
+        } else {
+            constructClusterTree(ctx, clusterRefs, clusters, clusterOffsets, right, middleIndex, end,
+                                 primOffset + leftSize);
+        }
+    });
+}
+
+ispc::Bvh* createLBVH(std::vector<ispc::Hittable>& objects, std::vector<ispc::Node>& nodes, const uint32_t maxLeafSize,
+                      bool refineTopLevels, BvhPhaseTimes* times = nullptr) {
+    std::vector<PrimitiveRef> refs = createPrimitiveRefs(objects);
+    size_t n = refs.size();
+    if (n < 2) {
+        return createBVH(objects, nodes, maxLeafSize, times);
+    }
+    markPhase(times, "refs");
+
+    BinGrid grid = createBinGrid(computeBoundsParallel(refs, 0, n).centroidBox);
+    std::vector<uint64_t> keys(n);
+    parallelChunks(n, bvhTaskChunkSize, bvhMaxTasks, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; i++) {
+            keys[i] = ((uint64_t)mortonCode(refs[i].centroid, grid) << 32) | i;
+        }
+    });
+    radixSortMorton(keys);
+    markPhase(times, "morton");
+
+    RadixTree tree;
+    tree.numLeaves = n;
+    tree.left.resize(n - 1);
+    tree.right.resize(n - 1);
+    tree.first.resize(2 * n - 1);
+    tree.last.resize(2 * n - 1);
+    tree.parent.resize(2 * n - 1);
+    tree.bbox.resize(2 * n - 1);
+    buildRadixTree(tree, keys);
+    computeRadixTreeBounds(tree, refs, keys);
+    markPhase(times, "radix tree");
+
+    nodes.resize(2 * n - 1);
+    LbvhContext ctx{tree, nodes, {1}, std::max(maxLeafSize, 1u)};
+
+    std::vector<PrimitiveRef> sorted(n);
+    if (!refineTopLevels) {
+        emitRadixTree(ctx, 0, 0, 0);
+        parallelChunks(n, bvhTaskChunkSize, bvhMaxTasks, [&](size_t begin, size_t end, int) {
+            for (size_t i = begin; i < end; i++) {
+                sorted[i] = refs[(uint32_t)keys[i]];
+            }
+        });
+    } else {
+        std::vector<uint32_t> clusters;
+        uint32_t clusterSize = std::max<size_t>(n / lbvhRefineClusters, 1);
+        collectClusters(tree, 0, clusterSize, clusters);
+
+        std::vector<PrimitiveRef> clusterRefs(clusters.size());
+        for (size_t c = 0; c < clusters.size(); c++) {
+            clusterRefs[c].bbox = tree.bbox[clusters[c]];
+            clusterRefs[c].centroid = center(clusterRefs[c].bbox);
+            clusterRefs[c].index = c;
+        }
+
+        std::vector<int64_t> clusterOffsets(clusters.size());
+        constructClusterTree(ctx, clusterRefs, clusters, clusterOffsets, 0, 0, clusterRefs.size(), 0);
+
+        launchTasks(std::min<size_t>(clusters.size(), bvhMaxTasks), [&](int task, int taskCount) {
+            for (size_t c = task; c < clusters.size(); c += taskCount) {
+                uint32_t first = tree.first[clusters[c]];
+                for (uint32_t i = first; i <= tree.last[clusters[c]]; i++) {
+                    sorted[i + clusterOffsets[c]] = refs[(uint32_t)keys[i]];
+                }
+            }
+        });
+    }
+
+    nodes.resize(ctx.nodeCount);
+    markPhase(times, refineTopLevels ? "refine" : "emit");
+
+    ispc::Bvh* bvh = finishBVH(objects, nodes, sorted);
+    markPhase(times, "reorder");
+    return bvh;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "bvh.h"
+#include "compactBvh.h"
+#include "raytracer.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Copying the spheres and quads of every leaf of a binary BVH into per-type arrays in leaf order,
+// and into SoA blocks (see LeafPrimitives in raytracer.ispc)
+
+const uint32_t leafBlockSize = 8;
+
+static_assert(sizeof(ispc::SphereBlock) == 4 * leafBlockSize * sizeof(float), "SphereBlock should hold 8 spheres");
+static_assert(sizeof(ispc::QuadBlock) == 16 * leafBlockSize * sizeof(float), "QuadBlock should hold 8 quads");
+
+using SphereBlocks = std::vector<ispc::SphereBlock, AlignedAllocator<ispc::SphereBlock>>;
+using QuadBlocks = std::vector<ispc::QuadBlock, AlignedAllocator<ispc::QuadBlock>>;
+
+void writeSphereSlot(ispc::SphereBlock& block, uint32_t slot, const ispc::Sphere& sphere) {
+    block.centerX[slot] = sphere.center.v[0];
+    block.centerY[slot] = sphere.center.v[1];
+    block.centerZ[slot] = sphere.center.v[2];
+    block.radius[slot] = sphere.radius;
+}
+
+void writeQuadSlot(ispc::QuadBlock& block, uint32_t slot, const ispc::Quad& quad) {
+    block.QX[slot] = quad.Q.v[0];
+    block.QY[slot] = quad.Q.v[1];
+    block.QZ[slot] = quad.Q.v[2];
+    block.uX[slot] = quad.u.v[0];
+    block.uY[slot] = quad.u.v[1];
+    block.uZ[slot] = quad.u.v[2];
+    block.vX[slot] = quad.v.v[0];
+    block.vY[slot] = quad.v.v[1];
+    block.vZ[slot] = quad.v.v[2];
+    block.normalX[slot] = quad.normal.v[0];
+    block.normalY[slot] = quad.normal.v[1];
+    block.normalZ[slot] = quad.normal.v[2];
+    block.D[slot] = quad.D;
+    block.wX[slot] = quad.w.v[0];
+    block.wY[slot] = quad.w.v[1];
+    block.wZ[slot] = quad.w.v[2];
+}
+
+// Arrays the leaf primitives of a BVH point into. They have to outlive the render.
+struct LeafPrimitiveStorage {
+    std::vector<ispc::LeafPrimitives> leaves;
+    std::vector<ispc::Sphere, AlignedAllocator<ispc::Sphere>> spheres;
+    std::vector<ispc::Quad, AlignedAllocator<ispc::Quad>> quads;
+    SphereBlocks sphereBlocks;
+    QuadBlocks quadBlocks;
+};
+
+// Orders the objects of every leaf spheres first, then quads, and copies them into the typed
+// arrays and blocks, so the kernels loop over contiguous primitives of one type instead of going
+// through a Hittable for each. These are copies, so they have to be made again whenever objects
+// move (see updateBVHHittable).
+void createLeafPrimitives(ispc::Bvh& bvh, LeafPrimitiveStorage& storage) {
+    const ispc::Node* nodes = sceneObject<ispc::Node>(bvh.nodes);
+    ispc::Hittable* objects = sceneObject<ispc::Hittable>(bvh.objects);
+
+    storage.leaves.assign(bvh.numNodes, ispc::LeafPrimitives{});
+    storage.spheres.clear();
+    storage.quads.clear();
+    storage.sphereBlocks.clear();
+    storage.quadBlocks.clear();
+
+    for (uint32_t i = 0; i < bvh.numNodes; i++) {
+        const ispc::Node& node = nodes[i];
+        if (node.left != node.right) {
+            continue;
+        }
+
+        ispc::Hittable* first = objects + node.start;
+        ispc::Hittable* last = first + node.size;
+        ispc::Hittable* firstQuad = std::stable_partition(
+            first, last, [](const ispc::Hittable& object) { return object.type == ispc::HittableType::SPHERE; });
+        ispc::Hittable* firstOther = std::stable_partition(
+            firstQuad, last, [](const ispc::Hittable& object) { return object.type == ispc::HittableType::QUAD; });
+
+        ispc::LeafPrimitives& leaf = storage.leaves[i];
+        leaf.firstSphere = storage.spheres.size();
+        leaf.numSpheres = firstQuad - first;
+        leaf.firstSphereBlock = storage.sphereBlocks.size();
+        leaf.firstQuad = storage.quads.size();
+        leaf.numQuads = firstOther - firstQuad;
+        leaf.firstQuadBlock = storage.quadBlocks.size();
+
+        storage.sphereBlocks.resize(leaf.firstSphereBlock + (leaf.numSpheres + leafBlockSize - 1) / leafBlockSize);
+        for (uint32_t j = 0; j < leaf.numSpheres; j++) {
+            const ispc::Sphere& sphere = *sceneObject<ispc::Sphere>(first[j].object);
+            storage.spheres.push_back(sphere);
+            writeSphereSlot(storage.sphereBlocks[leaf.firstSphereBlock + j / leafBlockSize], j % leafBlockSize, sphere);
+        }
+        storage.quadBlocks.resize(leaf.firstQuadBlock + (leaf.numQuads + leafBlockSize - 1) / leafBlockSize);
+        for (uint32_t j = 0; j < leaf.numQuads; j++) {
+            const ispc::Quad& quad = *sceneObject<ispc::Quad>(firstQuad[j].object);
+            storage.quads.push_back(quad);
+            writeQuadSlot(storage.quadBlocks[leaf.firstQuadBlock + j / leafBlockSize], j % leafBlockSize, quad);
+        }
+    }
+
+    bvh.leaves = sceneRef(storage.leaves.data());
+    bvh.spheres = sceneRef(storage.spheres.data());
+    bvh.quads = sceneRef(storage.quads.data());
+    bvh.sphereBlocks = sceneRef(storage.sphereBlocks.data());
+    bvh.quadBlocks = sceneRef(storage.quadBlocks.data());
+    bvh.numSpheres = storage.spheres.size();
+    bvh.numQuads = storage.quads.size();
+    bvh.numSphereBlocks = storage.sphereBlocks.size();
+    bvh.numQuadBlocks = storage.quadBlocks.size();
+}
@@ -1,10 +1,21 @@
 #include "bvh.h"
-#include "bvh.h"
+#include "bvhStats.h"
+#include "compactBvh.h"
+#include "instancing.h"
+#include "lbvh.h"
+#include "leafPrimitives.h"
+#include "meshLoader.h"
+#include "optimizeBvh.h"
+#include "quantizedBvh.h"
+#include "sbvh.h"
+#include "snapshot.h"
+#include "wideBvh.h"
 #include "raytracer.h"
 #include "scenes.h"
 #include <algorithm>
 #include <cfloat>
 #include <chrono>
+#include <cstring>
 #include <iostream>
 #include <limits>
 #include <random>
@@ -16,13 +27,17 @@ int main(int argc, char* argv[]) {
     int maxDepth;
     float vfov;
     bool usePackets;
-    bool useBVH;
-    int bvhMaxLeafSize;
+    BvhOptions bvhOptions;
     int scene;
+    int frames = 1;
+    const char* snapshotPath = nullptr;
+    const char* meshPath = nullptr;
 
-    if (argc != 9) {
+    if (argc < 9) {
         std::cout << "Usage: " << argv[0]
-                  << " <image width> <samples per pixel> <max depth> <vfov> <usePackets> <useBVH> <BVH leaf size> <scene>" << std::endl;
+                  << " <image width> <samples per pixel> <max depth> <vfov> <usePackets> <useBVH> <BVH leaf size> <scene>"
+                  << " [--builder=sah|lbvh|lbvh-sah|sbvh] [--width=2|4|8] [--compact] [--quantized] [--optimize[=passes]] [--frames=N]"
+                  << " [--bvh-stats] [--snapshot=path] [--mesh=path.ply|path.obj] [--check-occlusion]" << std::endl;
         return 1;
     }
 
@@ -31,18 +46,105 @@ int main(int argc, char* argv[]) {
     maxDepth = atoi(argv[3]);
     vfov = atoi(argv[4]);
     usePackets = atoi(argv[5]);
-    useBVH = atoi(argv[6]);
-    bvhMaxLeafSize = atoi(argv[7]);
+    bvhOptions.enabled = atoi(argv[6]);
+    bvhOptions.maxLeafSize = atoi(argv[7]);
+    bvhOptions.builder = BvhBuilder::SAH;
+    bvhOptions.width = 2;
+    bvhOptions.compact = false;
+    bvhOptions.quantized = false;
+    bvhOptions.optimizePasses = 0;
+    bvhOptions.stats = false;
+    bvhOptions.snapshot = nullptr;
+    bvhOptions.snapshotKey = 0;
+    bvhOptions.checkOcclusion = false;
     scene = atoi(argv[8]);
 
+    for (int i = 9; i < argc; i++) {
+        if (strcmp(argv[i], "--builder=sah") == 0) {
+            bvhOptions.builder = BvhBuilder::SAH;
+        } else if (strcmp(argv[i], "--builder=lbvh") == 0) {
+            bvhOptions.builder = BvhBuilder::LBVH;
+        } else if (strcmp(argv[i], "--builder=lbvh-sah") == 0) {
+            bvhOptions.builder = BvhBuilder::LBVH_SAH;
+        } else if (strcmp(argv[i], "--builder=sbvh") == 0) {
+            bvhOptions.builder = BvhBuilder::SBVH;
+        } else if (strcmp(argv[i], "--width=2") == 0) {
+            bvhOptions.width = 2;
+        } else if (strcmp(argv[i], "--width=4") == 0) {
+            bvhOptions.width = 4;
+        } else if (strcmp(argv[i], "--width=8") == 0) {
+            bvhOptions.width = 8;
+        } else if (strcmp(argv[i], "--compact") == 0) {
+            bvhOptions.compact = true;
+        } else if (strcmp(argv[i], "--quantized") == 0) {
+            bvhOptions.quantized = true;
+        } else if (strcmp(argv[i], "--optimize") == 0) {
+            bvhOptions.optimizePasses = 3;
+        } else if (strncmp(argv[i], "--optimize=", 11) == 0) {
+            bvhOptions.optimizePasses = std::max(atoi(argv[i] + 11), 0);
+        } else if (strncmp(argv[i], "--frames=", 9) == 0) {
+            frames = std::max(atoi(argv[i] + 9), 1);
+        } else if (strcmp(argv[i], "--bvh-stats") == 0) {
+            // Only builds the scene's trees and reports on them, so it needs a BVH whatever <useBVH> says.
+            bvhOptions.stats = true;
+            bvhOptions.enabled = true;
+        } else if (strncmp(argv[i], "--snapshot=", 11) == 0) {
+            snapshotPath = argv[i] + 11;
+        } else if (strncmp(argv[i], "--mesh=", 7) == 0) {
+            meshPath = argv[i] + 7;
+        } else if (strcmp(argv[i], "--check-occlusion") == 0) {
+            bvhOptions.checkOcclusion = true;
+        } else {
+            std::cout << "Unknown option: " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    // Leaf children store their object count in a byte.
+    if (bvhOptions.quantized && bvhOptions.maxLeafSize > quantizedMaxStep) {
+        std::cout << "Quantized BVH leaves hold at most " << quantizedMaxStep << " objects" << std::endl;
+        bvhOptions.maxLeafSize = quantizedMaxStep;
+    }
+
     // Print out parameters
     std::cout << "Image Width: " << imageWidth << std::endl;
     std::cout << "Samples per Pixel: " << samplesPerPixel << std::endl;
     std::cout << "Max Depth: " << maxDepth << std::endl;
     std::cout << "Vertical FOV: " << vfov << std::endl;
     std::cout << "Use Packets: " << usePackets << std::endl;
-    std::cout << "Use BVH: " << useBVH << std::endl;
-    std::cout << "BVH Leaf Size: " << bvhMaxLeafSize << std::endl;
+    std::cout << "Use BVH: " << bvhOptions.enabled << std::endl;
+    std::cout << "BVH Leaf Size: " << bvhOptions.maxLeafSize << std::endl;
+    std::cout << "BVH Builder: " << bvhBuilderName(bvhOptions.builder) << std::endl;
+    std::cout << "BVH Width: " << bvhOptions.width << std::endl;
+    std::cout << "Compact BVH: " << bvhOptions.compact << std::endl;
+    std::cout << "Quantized BVH: " << bvhOptions.quantized << std::endl;
+    std::cout << "BVH Optimization Passes: " << bvhOptions.optimizePasses << std::endl;
+    std::cout << "Frames: " << frames << std::endl;
+    std::cout << "BVH Stats: " << bvhOptions.stats << std::endl;
+    std::cout << "Snapshot: " << (snapshotPath != nullptr ? snapshotPath : "none") << std::endl;
+    std::cout << "Mesh: " << (meshPath != nullptr ? meshPath : "none") << std::endl;
+    std::cout << "Check Occlusion: " << bvhOptions.checkOcclusion << std::endl;
+
+    if (scene == 6 && meshPath == nullptr) {
+        std::cout << "Scene 6 needs a mesh, see --mesh" << std::endl;
+        return 1;
+    }
+
+    // A snapshot built with the same settings replaces building the scene. Animations move objects
+    // every frame and the statistics need a build, so neither uses one.
+    if (snapshotPath != nullptr && frames == 1 && !bvhOptions.stats) {
+        bvhOptions.snapshotKey = snapshotKey(scene, imageWidth, samplesPerPixel, maxDepth, vfov, bvhOptions, meshPath);
+        Snapshot snapshot;
+        if (loadSnapshot(snapshotPath, bvhOptions.snapshotKey, snapshot)) {
+            if (bvhOptions.checkOcclusion) {
+                checkOcclusion(*snapshot.camera, *snapshot.hittableList);
+            }
+            render(snapshot.camera, snapshot.hittableList, usePackets);
+            unloadSnapshot(snapshot);
+            return 0;
+        }
+        bvhOptions.snapshot = snapshotPath;
+    }
 
     // Set up Scene
     float ZOOM = 30.0f;
@@ -51,22 +153,32 @@ int main(int argc, char* argv[]) {
     switch (scene) {
     case 1:
         std::cout << "Scene: Cornell Box" << std::endl;
-        cornellBox(imageWidth, samplesPerPixel, maxDepth, vfov, useBVH, bvhMaxLeafSize, usePackets);
+        cornellBox(imageWidth, samplesPerPixel, maxDepth, vfov, bvhOptions, usePackets);
         break;
     case 2:
         std::cout << "Scene: random spheres" << std::endl;
-        randomSpheres(imageWidth, samplesPerPixel, maxDepth, vfov, useBVH, bvhMaxLeafSize, usePackets); // From book
+        randomSpheres(imageWidth, samplesPerPixel, maxDepth, vfov, bvhOptions, usePackets, frames); // From book
         break;
     case 3:
         std::cout << "Scene: random spheres w/ extra spheres" << std::endl;
-        randomSpheres(imageWidth, samplesPerPixel, maxDepth, vfov, useBVH, bvhMaxLeafSize, usePackets, NUM_SPHERES,
+        randomSpheres(imageWidth, samplesPerPixel, maxDepth, vfov, bvhOptions, usePackets, frames, NUM_SPHERES,
                       ZOOM); // More Spheres
         break;
     case 4:
         std::cout << "Scene: middle random spheres" << std::endl;
-        randomSpheres(imageWidth, samplesPerPixel, maxDepth, vfov, useBVH, bvhMaxLeafSize, usePackets, 20,
+        randomSpheres(imageWidth, samplesPerPixel, maxDepth, vfov, bvhOptions, usePackets, frames, 20,
                       ZOOM / 2); // More Spheres
         break;
+    case 5:
+        std::cout << "Scene: instanced sphere field" << std::endl;
+        instancedSpheres(imageWidth, samplesPerPixel, maxDepth, vfov, bvhOptions, usePackets);
+        break;
+    case 6:
+        std::cout << "Scene: triangle mesh" << std::endl;
+        if (!triangleMesh(imageWidth, samplesPerPixel, maxDepth, vfov, bvhOptions, usePackets, meshPath)) {
+            return 1;
+        }
+        break;
     default:
         std::cout << "Invalid scene number" << std::endl;
         return 1;
@@ -0,0 +1,682 @@
+#pragma once
+
+#include "bvh.h"
+#include "compactBvh.h"
+#include "raytracer.h"
+#include "taskUtils.h"
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// Triangle meshes and their loaders
+//
+// A mesh is loaded straight into SoA vertex buffers and a triangle index buffer, which TriangleMesh
+// points into. Every triangle is then a hittable of its own, so the BVH builders split meshes like
+// any other primitives. The file is memory mapped rather than read: binary PLY vertices are fixed
+// size records copied out in parallel, and OBJ is cut into chunks at line boundaries that are
+// parsed in parallel, with a counting pass first so every chunk knows where its output goes.
+
+const size_t meshLoadChunkSize = 1 << 20; // Bytes of OBJ, or PLY records, per task at least
+const int meshLoadMaxTasks = 64;
+
+// Vertex and index buffers of a mesh. TriangleMesh refers to them, so they have to outlive it.
+struct MeshBuffers {
+    std::vector<float, AlignedAllocator<float>> x;
+    std::vector<float, AlignedAllocator<float>> y;
+    std::vector<float, AlignedAllocator<float>> z;
+    std::vector<uint32_t, AlignedAllocator<uint32_t>> indices; // Three per triangle
+};
+
+struct MappedFile {
+    const char* data;
+    size_t size;
+};
+
+bool mapFile(const char* path, MappedFile& file) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = fileStat.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    madvise(mapping, size, MADV_WILLNEED);
+
+    file.data = (const char*)mapping;
+    file.size = size;
+    return true;
+}
+
+void unmapFile(MappedFile& file) { munmap((void*)file.data, file.size); }
+
+// Binary PLY
+
+enum class PlyType { INT8, UINT8, INT16, UINT16, INT32, UINT32, FLOAT32, FLOAT64, INVALID };
+
+PlyType plyType(const std::string& name) {
+    if (name == "char" || name == "int8") {
+        return PlyType::INT8;
+    } else if (name == "uchar" || name == "uint8") {
+        return PlyType::UINT8;
+    } else if (name == "short" || name == "int16") {
+        return PlyType::INT16;
+    } else if (name == "ushort" || name == "uint16") {
+        return PlyType::UINT16;
+    } else if (name == "int" || name == "int32") {
+        return PlyType::INT32;
+    } else if (name == "uint" || name == "uint32") {
+        return PlyType::UINT32;
+    } else if (name == "float" || name == "float32") {
+        return PlyType::FLOAT32;
+    } else if (name == "double" || name == "float64") {
+        return PlyType::FLOAT64;
+    }
+    return PlyType::INVALID;
+}
+
+size_t plyTypeSize(PlyType type) {
+    switch (type) {
+    case PlyType::INT8:
+    case PlyType::UINT8:
+        return 1;
+    case PlyType::INT16:
+    case PlyType::UINT16:
+        return 2;
+    case PlyType::INT32:
+    case PlyType::UINT32:
+    case PlyType::FLOAT32:
+        return 4;
+    case PlyType::FLOAT64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+// Reads a little endian value, which is what the host is.
+template <typename T>
+T readValue(const char* p) {
+    T value;
+    memcpy(&value, p, sizeof(T));
+    return value;
+}
+
+double readPlyValue(const char* p, PlyType type) {
+    switch (type) {
+    case PlyType::INT8:
+        return readValue<int8_t>(p);
+    case PlyType::UINT8:
+        return readValue<uint8_t>(p);
+    case PlyType::INT16:
+        return readValue<int16_t>(p);
+    case PlyType::UINT16:
+        return readValue<uint16_t>(p);
+    case PlyType::INT32:
+        return readValue<int32_t>(p);
+    case PlyType::UINT32:
+        return readValue<uint32_t>(p);
+    case PlyType::FLOAT32:
+        return readValue<float>(p);
+    case PlyType::FLOAT64:
+        return readValue<double>(p);
+    default:
+        return 0.0;
+    }
+}
+
+struct PlyProperty {
+    std::string name;
+    PlyType type;      // Of the value, or of the items of a list
+    PlyType countType; // INVALID unless the property is a list
+    size_t offset;     // From the start of the record, for elements without lists
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count;
+    std::vector<PlyProperty> properties;
+    size_t recordSize; // 0 if the records have lists and so differ in size
+};
+
+const PlyProperty* findPlyProperty(const PlyElement& element, const char* name) {
+    for (const PlyProperty& property : element.properties) {
+        if (property.name == name) {
+            return &property;
+        }
+    }
+    return nullptr;
+}
+
+// Parses the header and returns the offset of the data after it, or 0 if the file is not a binary
+// little endian PLY this loader can read.
+size_t parsePlyHeader(const MappedFile& file, std::vector<PlyElement>& elements, std::string& problem) {
+    size_t pos = 0;
+    bool first = true;
+    while (pos < file.size) {
+        const char* lineEnd = (const char*)memchr(file.data + pos, '\n', file.size - pos);
+        if (lineEnd == nullptr) {
+            break;
+        }
+        std::string line(file.data + pos, lineEnd);
+        pos = lineEnd - file.data + 1;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+
+        std::vector<std::string> words;
+        for (size_t start = 0; start < line.size();) {
+            size_t end = line.find(' ', start);
+            end = end == std::string::npos ? line.size() : end;
+            if (end > start) {
+                words.push_back(line.substr(start, end - start));
+            }
+            start = end + 1;
+        }
+
+        if (first) {
+            if (line != "ply") {
+                problem = "not a PLY file";
+                return 0;
+            }
+            first = false;
+        } else if (words.empty() || words[0] == "comment" || words[0] == "obj_info") {
+            continue;
+        } else if (words[0] == "format") {
+            if (words.size() < 2 || words[1] != "binary_little_endian") {
+                problem = "only binary_little_endian PLY is supported";
+                return 0;
+            }
+        } else if (words[0] == "element" && words.size() == 3) {
+            elements.push_back(PlyElement{words[1], strtoull(words[2].c_str(), nullptr, 10), {}, 0});
+        } else if (words[0] == "property" && !elements.empty()) {
+            PlyProperty property;
+            if (words.size() == 5 && words[1] == "list") {
+                property = PlyProperty{words[4], plyType(words[3]), plyType(words[2]), 0};
+                if (property.countType == PlyType::INVALID) {
+                    problem = "unknown PLY type " + words[2];
+                    return 0;
+                }
+            } else if (words.size() == 3) {
+                property = PlyProperty{words[2], plyType(words[1]), PlyType::INVALID, 0};
+            } else {
+                problem = "malformed PLY property";
+                return 0;
+            }
+            if (property.type == PlyType::INVALID) {
+                problem = "unknown PLY type in " + line;
+                return 0;
+            }
+            elements.back().properties.push_back(property);
+        } else if (words[0] == "end_header") {
+            for (PlyElement& element : elements) {
+                size_t size = 0;
+                for (PlyProperty& property : element.properties) {
+                    if (property.countType != PlyType::INVALID) {
+                        size = 0;
+                        break;
+                    }
+                    property.offset = size;
+                    size += plyTypeSize(property.type);
+                }
+                element.recordSize = size;
+            }
+            return pos;
+        } else {
+            problem = "unexpected PLY header line " + line;
+            return 0;
+        }
+    }
+
+    problem = "PLY header has no end_header";
+    return 0;
+}
+
+// Size of one record, walking its lists, or 0 if it runs past the end of the file.
+size_t plyRecordSize(const PlyElement& element, const char* record, const char* end) {
+    size_t size = 0;
+    for (const PlyProperty& property : element.properties) {
+        if (property.countType == PlyType::INVALID) {
+            size += plyTypeSize(property.type);
+            continue;
+        }
+        if (record + size + plyTypeSize(property.countType) > end) {
+            return 0;
+        }
+        size_t count = (size_t)readPlyValue(record + size, property.countType);
+        size += plyTypeSize(property.countType) + count * plyTypeSize(property.type);
+    }
+    return record + size <= end ? size : 0;
+}
+
+// Copies the vertex positions out of their fixed size records, in parallel. Returns false on a
+// malformed file.
+bool readPlyVertices(const PlyElement& element, const char* data, const char* end, MeshBuffers& mesh,
+                     std::string& problem) {
+    const PlyProperty* px = findPlyProperty(element, "x");
+    const PlyProperty* py = findPlyProperty(element, "y");
+    const PlyProperty* pz = findPlyProperty(element, "z");
+    if (element.recordSize == 0 || px == nullptr || py == nullptr || pz == nullptr) {
+        problem = "PLY vertices need fixed size records with x, y and z";
+        return false;
+    }
+    if ((size_t)(end - data) / element.recordSize < element.count) {
+        problem = "PLY vertex data is truncated";
+        return false;
+    }
+
+    mesh.x.resize(element.count);
+    mesh.y.resize(element.count);
+    mesh.z.resize(element.count);
+    size_t minChunk = std::max<size_t>(meshLoadChunkSize / element.recordSize, 1);
+    parallelChunks(element.count, minChunk, meshLoadMaxTasks, [&](size_t first, size_t last, int) {
+        for (size_t i = first; i < last; i++) {
+            const char* record = data + i * element.recordSize;
+            mesh.x[i] = readPlyValue(record + px->offset, px->type);
+            mesh.y[i] = readPlyValue(record + py->offset, py->type);
+            mesh.z[i] = readPlyValue(record + pz->offset, pz->type);
+        }
+    });
+    return true;
+}
+
+// Reads the faces, splitting polygons into fans. When every face is a triangle and holds nothing
+// but its indices the records are fixed size and are read in parallel like the vertices; anything
+// else is walked in order. Returns the size of the element, or 0 on a malformed file.
+size_t readPlyFaces(const PlyElement& element, const char* data, const char* end, MeshBuffers& mesh,
+                    std::string& problem) {
+    const PlyProperty* list = findPlyProperty(element, "vertex_indices");
+    list = list != nullptr ? list : findPlyProperty(element, "vertex_index");
+    if (list == nullptr || list->countType == PlyType::INVALID) {
+        problem = "PLY faces have no vertex_indices list";
+        return 0;
+    }
+
+    size_t countSize = plyTypeSize(list->countType);
+    size_t indexSize = plyTypeSize(list->type);
+    size_t triangleRecord = countSize + 3 * indexSize;
+    if (element.properties.size() == 1 && (size_t)(end - data) >= element.count * triangleRecord) {
+        std::atomic<bool> allTriangles = true;
+        mesh.indices.resize(3 * element.count);
+        size_t minChunk = std::max<size_t>(meshLoadChunkSize / triangleRecord, 1);
+        parallelChunks(element.count, minChunk, meshLoadMaxTasks, [&](size_t first, size_t last, int) {
+            for (size_t i = first; i < last && allTriangles.load(std::memory_order_relaxed); i++) {
+                const char* record = data + i * triangleRecord;
+                if (readPlyValue(record, list->countType) != 3) {
+                    allTriangles = false;
+                    break;
+                }
+                for (int k = 0; k < 3; k++) {
+                    mesh.indices[3 * i + k] = (uint32_t)readPlyValue(record + countSize + k * indexSize, list->type);
+                }
+            }
+        });
+        if (allTriangles) {
+            return element.count * triangleRecord;
+        }
+        mesh.indices.clear();
+    }
+
+    const char* record = data;
+    for (size_t i = 0; i < element.count; i++) {
+        size_t size = plyRecordSize(element, record, end);
+        if (size == 0) {
+            problem = "PLY file is truncated";
+            return 0;
+        }
+
+        const char* items = record;
+        for (const PlyProperty& property : element.properties) {
+            if (&property == list) {
+                break;
+            }
+            items += property.countType == PlyType::INVALID
+                         ? plyTypeSize(property.type)
+                         : plyTypeSize(property.countType) +
+                               (size_t)readPlyValue(items, property.countType) * plyTypeSize(property.type);
+        }
+        size_t count = (size_t)readPlyValue(items, list->countType);
+        items += countSize;
+        for (size_t k = 2; k < count; k++) {
+            mesh.indices.push_back((uint32_t)readPlyValue(items, list->type));
+            mesh.indices.push_back((uint32_t)readPlyValue(items + (k - 1) * indexSize, list->type));
+            mesh.indices.push_back((uint32_t)readPlyValue(items + k * indexSize, list->type));
+        }
+        record += size;
+    }
+    return record - data;
+}
+
+bool loadPLY(const MappedFile& file, MeshBuffers& mesh, std::string& problem) {
+    std::vector<PlyElement> elements;
+    size_t pos = parsePlyHeader(file, elements, problem);
+    if (pos == 0) {
+        return false;
+    }
+
+    const char* data = file.data + pos;
+    const char* end = file.data + file.size;
+    bool haveVertices = false;
+    for (const PlyElement& element : elements) {
+        size_t size = 0;
+        if (element.name == "vertex") {
+            if (!readPlyVertices(element, data, end, mesh, problem)) {
+                return false;
+            }
+            haveVertices = true;
+            size = element.count * element.recordSize;
+        } else if (element.name == "face") {
+            // Indices are checked once all the vertices are known.
+            size = readPlyFaces(element, data, end, mesh, problem);
+            if (size == 0 && element.count > 0) {
+                return false;
+            }
+        } else if (element.recordSize > 0) {
+            size = element.count * element.recordSize;
+        } else {
+            for (size_t i = 0; i < element.count; i++) {
+                size_t recordSize = plyRecordSize(element, data + size, end);
+                if (recordSize == 0) {
+                    problem = "PLY file is truncated";
+                    return false;
+                }
+                size += recordSize;
+            }
+        }
+        if (size > (size_t)(end - data)) {
+            problem = "PLY file is truncated";
+            return false;
+        }
+        data += size;
+    }
+
+    if (!haveVertices) {
+        problem = "PLY file has no vertices";
+        return false;
+    }
+    return true;
+}
+
+// OBJ
+
+bool isObjSpace(char c) { return c == ' ' || c == '\t'; }
+
+void skipObjSpace(const char*& p, const char* end) {
+    while (p < end && isObjSpace(*p)) {
+        p++;
+    }
+}
+
+// Parses a decimal float with an optional exponent, which is all OBJ exporters write. Parsing by
+// hand avoids the locale and the copy that strtof would need, as the mapping is not null
+// terminated.
+bool parseObjFloat(const char*& p, const char* end, float& value) {
+    static const double powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10,
+                                    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) {
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+        if (mantissa < 100000000000000000ull) {
+            mantissa = mantissa * 10 + (*p - '0');
+        } else {
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+            if (mantissa < 100000000000000000ull) {
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent--;
+            }
+        }
+    }
+    if (digits == 0) {
+        return false;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool negativeExponent = p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+')) {
+            p++;
+        }
+        int e = 0;
+        if (p >= end || *p < '0' || *p > '9') {
+            return false;
+        }
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            e = std::min(e * 10 + (*p - '0'), 1000);
+        }
+        exponent += negativeExponent ? -e : e;
+    }
+
+    double result = (double)mantissa;
+    if (exponent < 0) {
+        result = -exponent <= 22 ? result / powers[-exponent] : result * std::pow(10.0, exponent);
+    } else if (exponent > 0) {
+        result = exponent <= 22 ? result * powers[exponent] : result * std::pow(10.0, exponent);
+    }
+    value = (float)(negative ? -result : result);
+    return true;
+}
+
+bool parseObjInt(const char*& p, const char* end, int64_t& value) {
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) {
+        p++;
+    }
+    if (p >= end || *p < '0' || *p > '9') {
+        return false;
+    }
+    int64_t result = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        result = std::min<int64_t>(result * 10 + (*p - '0'), INT64_C(1) << 40);
+    }
+    value = negative ? -result : result;
+    return true;
+}
+
+const char* nextObjLine(const char* p, const char* end) {
+    const char* newline = (const char*)memchr(p, '\n', end - p);
+    return newline != nullptr ? newline + 1 : end;
+}
+
+// The chunk covering [begin, end) of the file holds the lines that start in it.
+const char* objLineStart(const MappedFile& file, size_t pos) {
+    if (pos == 0 || pos >= file.size) {
+        return file.data + std::min(pos, file.size);
+    }
+    return nextObjLine(file.data + pos - 1, file.data + file.size);
+}
+
+struct ObjChunk {
+    const char* begin;
+    const char* end;
+    size_t numVertices;
+    size_t numTriangles;
+    bool failed;
+};
+
+// Counts the vertices and triangles of a chunk, or with counting false writes them at the chunk's
+// offsets, given as its counts. Face indices are 1-based, or negative to count back from the last
+// vertex before the face.
+void parseObjChunk(ObjChunk& chunk, MeshBuffers* mesh, size_t firstVertex, size_t firstTriangle) {
+    size_t numVertices = 0;
+    size_t numTriangles = 0;
+    uint32_t face[3];
+    for (const char* line = chunk.begin; line < chunk.end;) {
+        const char* lineEnd = nextObjLine(line, chunk.end);
+        const char* p = line;
+        skipObjSpace(p, lineEnd);
+
+        if (lineEnd - p > 2 && p[0] == 'v' && isObjSpace(p[1])) {
+            p++;
+            if (mesh != nullptr) {
+                float xyz[3];
+                for (int k = 0; k < 3; k++) {
+                    skipObjSpace(p, lineEnd);
+                    if (!parseObjFloat(p, lineEnd, xyz[k])) {
+                        chunk.failed = true;
+                        return;
+                    }
+                }
+                mesh->x[firstVertex + numVertices] = xyz[0];
+                mesh->y[firstVertex + numVertices] = xyz[1];
+                mesh->z[firstVertex + numVertices] = xyz[2];
+            }
+            numVertices++;
+        } else if (lineEnd - p > 2 && p[0] == 'f' && isObjSpace(p[1])) {
+            p++;
+            int corners = 0;
+            while (true) {
+                skipObjSpace(p, lineEnd);
+                if (p >= lineEnd || *p == '\r' || *p == '\n' || *p == '#') {
+                    break;
+                }
+                if (mesh != nullptr) {
+                    int64_t index;
+                    if (!parseObjInt(p, lineEnd, index) || index == 0) {
+                        chunk.failed = true;
+                        return;
+                    }
+                    int64_t vertex = index > 0 ? index - 1 : (int64_t)(firstVertex + numVertices) + index;
+                    if (vertex < 0 || vertex >= (int64_t)mesh->x.size()) {
+                        chunk.failed = true;
+                        return;
+                    }
+                    // Fan around the first corner
+                    face[corners < 2 ? corners : 2] = (uint32_t)vertex;
+                    if (corners >= 2) {
+                        uint32_t* triangle = &mesh->indices[3 * (firstTriangle + numTriangles + corners - 2)];
+                        triangle[0] = face[0];
+                        triangle[1] = face[1];
+                        triangle[2] = face[2];
+                        face[1] = face[2];
+                    }
+                }
+                // Skip the texture and normal indices
+                while (p < lineEnd && !isObjSpace(*p) && *p != '\r' && *p != '\n') {
+                    p++;
+                }
+                corners++;
+            }
+            if (corners < 3 && corners > 0) {
+                chunk.failed = true;
+                return;
+            }
+            numTriangles += corners >= 3 ? corners - 2 : 0;
+        }
+        line = lineEnd;
+    }
+
+    if (mesh == nullptr) {
+        chunk.numVertices = numVertices;
+        chunk.numTriangles = numTriangles;
+    }
+}
+
+bool loadOBJ(const MappedFile& file, MeshBuffers& mesh, std::string& problem) {
+    std::vector<ObjChunk> chunks(meshLoadMaxTasks);
+    int numChunks = parallelChunks(file.size, meshLoadChunkSize, meshLoadMaxTasks, [&](size_t begin, size_t end, int i) {
+        chunks[i] = ObjChunk{objLineStart(file, begin), objLineStart(file, end), 0, 0, false};
+        parseObjChunk(chunks[i], nullptr, 0, 0);
+    });
+    chunks.resize(numChunks);
+
+    std::vector<size_t> firstVertex(numChunks + 1, 0);
+    std::vector<size_t> firstTriangle(numChunks + 1, 0);
+    for (int i = 0; i < numChunks; i++) {
+        firstVertex[i + 1] = firstVertex[i] + chunks[i].numVertices;
+        firstTriangle[i + 1] = firstTriangle[i] + chunks[i].numTriangles;
+    }
+    if (firstVertex[numChunks] > UINT32_MAX || 3 * firstTriangle[numChunks] > UINT32_MAX) {
+        problem = "OBJ file has too many vertices or triangles";
+        return false;
+    }
+
+    mesh.x.resize(firstVertex[numChunks]);
+    mesh.y.resize(firstVertex[numChunks]);
+    mesh.z.resize(firstVertex[numChunks]);
+    mesh.indices.resize(3 * firstTriangle[numChunks]);
+    launchTasks(numChunks,
+                [&](int i, int) { parseObjChunk(chunks[i], &mesh, firstVertex[i], firstTriangle[i]); });
+
+    for (const ObjChunk& chunk : chunks) {
+        if (chunk.failed) {
+            problem = "malformed vertex or face in OBJ file";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Loads a .ply or .obj file, going by its extension. Prints what went wrong and returns false if it
+// cannot.
+bool loadMesh(const char* path, MeshBuffers& mesh) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::string name = path;
+    std::string extension = name.substr(std::min(name.rfind('.'), name.size()));
+    for (char& c : extension) {
+        c = tolower(c);
+    }
+    if (extension != ".ply" && extension != ".obj") {
+        std::cout << "Could not load mesh " << path << ": only .ply and .obj files are supported" << std::endl;
+        return false;
+    }
+
+    MappedFile file;
+    if (!mapFile(path, file)) {
+        std::cout << "Could not load mesh " << path << ": could not map it" << std::endl;
+        return false;
+    }
+    std::string problem;
+    bool loaded = extension == ".ply" ? loadPLY(file, mesh, problem) : loadOBJ(file, mesh, problem);
+    unmapFile(file);
+
+    if (loaded) {
+        for (uint32_t index : mesh.indices) {
+            if (index >= mesh.x.size()) {
+                loaded = false;
+                problem = "face refers to a vertex that does not exist";
+                break;
+            }
+        }
+    }
+    if (!loaded) {
+        std::cout << "Could not load mesh " << path << ": " << problem << std::endl;
+        return false;
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    std::cout << "Mesh " << path << ": " << mesh.x.size() << " vertices, " << mesh.indices.size() / 3
+              << " triangles, loaded in " << duration.count() << " milliseconds" << std::endl;
+    return true;
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include "bvh.h"
+#include "raytracer.h"
+#include "taskUtils.h"
+#include <bit>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+// Post-build treelet restructuring (Karras and Aila, "Fast Parallel Construction of High-Quality
+// Bounding Volume Hierarchies")
+//
+// A treelet is a node together with the descendants it takes to reach a handful of subtrees,
+// its leaves. Every binary tree over those leaves is tried with a dynamic program over the subsets,
+// and the cheapest one replaces the treelet's topology, reusing its inner nodes. Treelets are
+// processed bottom-up so each one sees already optimized subtrees, and the two subtrees of a node
+// are independent, so they are optimized as parallel tasks.
+
+const int treeletLeaves = 7;
+const int treeletSubsets = 1 << treeletLeaves;
+
+// Subtrees with fewer primitives than this are left as the builder made them.
+const uint32_t treeletMinSize = 8;
+
+// SAH cost of the subtree below nodeIndex, unnormalized.
+float subtreeCost(const std::vector<ispc::Node>& nodes, const std::vector<float>& costs, uint32_t nodeIndex) {
+    const ispc::Node& node = nodes[nodeIndex];
+    if (node.left == node.right) {
+        return bvhIntersectionCost * node.size * surfaceArea(node.bbox);
+    }
+    return bvhTraversalCost * surfaceArea(node.bbox) + costs[node.left] + costs[node.right];
+}
+
+// SAH cost of the whole tree relative to its root box.
+float treeCost(const std::vector<ispc::Node>& nodes, uint32_t root) {
+    std::vector<float> costs(nodes.size());
+    for (size_t i = nodes.size(); i-- > 0;) {
+        // Children come after their parents in every builder's output.
+        costs[i] = subtreeCost(nodes, costs, i);
+    }
+    return costs[root] / surfaceArea(nodes[root].bbox);
+}
+
+struct Treelet {
+    uint32_t leaves[treeletLeaves];
+    uint32_t inner[treeletLeaves - 1];
+    int numLeaves;
+    int numInner;
+};
+
+// Grows the treelet below root by repeatedly opening the leaf with the largest surface area.
+Treelet formTreelet(const std::vector<ispc::Node>& nodes, uint32_t root) {
+    Treelet treelet;
+    treelet.inner[0] = root;
+    treelet.numInner = 1;
+    treelet.leaves[0] = nodes[root].left;
+    treelet.leaves[1] = nodes[root].right;
+    treelet.numLeaves = 2;
+
+    while (treelet.numLeaves < treeletLeaves) {
+        int best = -1;
+        float bestArea = -1.0f;
+        for (int i = 0; i < treelet.numLeaves; i++) {
+            const ispc::Node& node = nodes[treelet.leaves[i]];
+            if (node.left != node.right && surfaceArea(node.bbox) > bestArea) {
+                best = i;
+                bestArea = surfaceArea(node.bbox);
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+
+        uint32_t opened = treelet.leaves[best];
+        treelet.inner[treelet.numInner++] = opened;
+        treelet.leaves[best] = nodes[opened].left;
+        treelet.leaves[treelet.numLeaves++] = nodes[opened].right;
+    }
+    return treelet;
+}
+
+struct TreeletSolution {
+    float cost[treeletSubsets];
+    uint8_t partition[treeletSubsets];
+};
+
+// Rebuilds the part of the treelet covering subset, taking inner nodes from the treelet in order.
+// Returns the index of the node that now roots the subset.
+uint32_t rebuildTreelet(std::vector<ispc::Node>& nodes, std::vector<float>& costs, const Treelet& treelet,
+                        const TreeletSolution& solution, uint32_t subset, int& nextInner) {
+    if (std::popcount(subset) == 1) {
+        return treelet.leaves[std::countr_zero(subset)];
+    }
+
+    uint32_t nodeIndex = treelet.inner[nextInner++];
+    uint32_t leftSubset = solution.partition[subset];
+    uint32_t left = rebuildTreelet(nodes, costs, treelet, solution, leftSubset, nextInner);
+    uint32_t right = rebuildTreelet(nodes, costs, treelet, solution, subset & ~leftSubset, nextInner);
+
+    ispc::Node& node = nodes[nodeIndex];
+    node.bbox = createAABB(nodes[left].bbox, nodes[right].bbox);
+    node.size = nodes[left].size + nodes[right].size;
+    node.left = left;
+    node.right = right;
+    costs[nodeIndex] = solution.cost[subset];
+    return nodeIndex;
+}
+
+// Finds the cheapest binary tree over the treelet's leaves and applies it if it beats the current
+// one.
+void restructureTreelet(std::vector<ispc::Node>& nodes, std::vector<float>& costs, uint32_t root) {
+    Treelet treelet = formTreelet(nodes, root);
+    if (treelet.numLeaves < 3) {
+        return;
+    }
+
+    int n = treelet.numLeaves;
+    uint32_t full = (1u << n) - 1;
+    ispc::aabb boxes[treeletSubsets];
+    TreeletSolution solution;
+
+    for (uint32_t subset = 1; subset <= full; subset++) {
+        int lowest = std::countr_zero(subset);
+        uint32_t rest = subset & (subset - 1);
+        boxes[subset] = rest == 0 ? nodes[treelet.leaves[lowest]].bbox : createAABB(boxes[rest], boxes[1u << lowest]);
+    }
+
+    // Subsets in increasing order means every proper subset is solved before the sets containing it.
+    for (uint32_t subset = 1; subset <= full; subset++) {
+        if (std::popcount(subset) == 1) {
+            solution.cost[subset] = costs[treelet.leaves[std::countr_zero(subset)]];
+            continue;
+        }
+
+        // Only partitions whose left side holds the lowest leaf, so each split is seen once.
+        uint32_t lowestBit = subset & (0u - subset);
+        float best = std::numeric_limits<float>::max();
+        uint32_t bestPartition = 0;
+        for (uint32_t part = (subset - 1) & subset; part != 0; part = (part - 1) & subset) {
+            if ((part & lowestBit) == 0) {
+                continue;
+            }
+            float cost = solution.cost[part] + solution.cost[subset & ~part];
+            if (cost < best) {
+                best = cost;
+                bestPartition = part;
+            }
+        }
+        solution.cost[subset] = bvhTraversalCost * surfaceArea(boxes[subset]) + best;
+        solution.partition[subset] = bestPartition;
+    }
+
+    if (solution.cost[full] >= costs[root] * 0.9999f) {
+        return;
+    }
+
+    int nextInner = 0;
+    rebuildTreelet(nodes, costs, treelet, solution, full, nextInner);
+}
+
+// Optimizes both subtrees before the treelet rooted at nodeIndex. Inner nodes still hold their
+// primitive count, which decides when to go parallel and when a subtree is too small to bother.
+void optimizeNode(std::vector<ispc::Node>& nodes, std::vector<float>& costs, uint32_t nodeIndex) {
+    const ispc::Node& node = nodes[nodeIndex];
+    if (node.left == node.right || node.size < treeletMinSize) {
+        return;
+    }
+
+    uint32_t children[2] = {node.left, node.right};
+    if (node.size < bvhParallelSubtreeSize) {
+        optimizeNode(nodes, costs, children[0]);
+        optimizeNode(nodes, costs, children[1]);
+    } else {
+        launchTasks(2, [&](int child, int) { optimizeNode(nodes, costs, children[child]); });
+    }
+
+    costs[nodeIndex] = subtreeCost(nodes, costs, nodeIndex);
+    restructureTreelet(nodes, costs, nodeIndex);
+}
+
+// Copies the subtree below oldIndex depth first into newNodes, with sibling pairs next to each other
+// after their parent, and appends its objects in leaf order.
+void relayoutNode(const std::vector<ispc::Node>& nodes, const std::vector<ispc::Hittable>& objects,
+                  std::vector<ispc::Node>& newNodes, std::vector<ispc::Hittable>& newObjects, uint32_t oldIndex,
+                  uint32_t newIndex) {
+    const ispc::Node& node = nodes[oldIndex];
+    size_t start = newObjects.size();
+
+    if (node.left == node.right) {
+        newObjects.insert(newObjects.end(), objects.begin() + node.start, objects.begin() + node.start + node.size);
+        writeNode(newNodes, newIndex, node.bbox, start, node.size, 0, 0);
+        return;
+    }
+
+    size_t left = newNodes.size();
+    newNodes.resize(left + 2);
+    relayoutNode(nodes, objects, newNodes, newObjects, node.left, left);
+    relayoutNode(nodes, objects, newNodes, newObjects, node.right, left + 1);
+    writeNode(newNodes, newIndex, node.bbox, start, newObjects.size() - start, left, left + 1);
+}
+
+// Runs the given number of restructuring passes over a built tree, then lays nodes and objects out
+// again so leaves index contiguous object ranges and children follow their parents, as after a
+// build.
+void optimizeBVH(std::vector<ispc::Hittable>& objects, std::vector<ispc::Node>& nodes, ispc::Bvh* bvh, int passes) {
+    auto start = std::chrono::high_resolution_clock::now();
+    float before = treeCost(nodes, bvh->root);
+
+    std::vector<float> costs(nodes.size());
+    for (size_t i = nodes.size(); i-- > 0;) {
+        costs[i] = subtreeCost(nodes, costs, i);
+    }
+    for (int pass = 0; pass < passes; pass++) {
+        optimizeNode(nodes, costs, bvh->root);
+    }
+
+    std::vector<ispc::Node> newNodes(1);
+    newNodes.reserve(nodes.size());
+    std::vector<ispc::Hittable> newObjects;
+    newObjects.reserve(objects.size());
+    relayoutNode(nodes, objects, newNodes, newObjects, bvh->root, 0);
+    nodes.swap(newNodes);
+    objects.swap(newObjects);
+
+    bvh->objects = sceneRef(objects.data());
+    bvh->nodes = sceneRef(nodes.data());
+    bvh->numNodes = nodes.size();
+    bvh->root = 0;
+
+    float after = treeCost(nodes, bvh->root);
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    std::cout << "BVH optimization: SAH cost " << before << " -> " << after << " in " << duration.count()
+              << " milliseconds" << std::endl;
+}
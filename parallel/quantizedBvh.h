@@ -0,0 +1,126 @@
+#pragma once
+
+#include "bvh.h"
+#include "compactBvh.h"
+#include "raytracer.h"
+#include "wideBvh.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Quantizing a wide BVH into QuantizedNodes with 8-bit child boxes
+
+const uint32_t quantizedMaxStep = 255;
+const int quantizedMinExponent = -126; // Keeps 2^exponent a normal float
+
+using QuantizedNodes = std::vector<ispc::QuantizedNode, AlignedAllocator<ispc::QuantizedNode>>;
+
+static_assert(sizeof(ispc::QuantizedNode) == 80, "QuantizedNode should be 10 bytes per child");
+
+// Both sides do the same float operations, so the builder sees exactly the boxes traversal decodes.
+float exponentScale(int exponent) {
+    uint32_t bits = (uint32_t)(exponent + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return scale;
+}
+
+float decodeStep(float origin, uint32_t step, float scale) { return origin + (float)step * scale; }
+
+// Smallest step that covers the axis from min to max in quantizedMaxStep steps.
+int quantizedExponent(float min, float max) {
+    int exponent;
+    std::frexp((max - min) / quantizedMaxStep, &exponent);
+    exponent = std::max(exponent, quantizedMinExponent);
+    while (decodeStep(min, quantizedMaxStep, exponentScale(exponent)) < max) {
+        exponent++;
+    }
+    return exponent;
+}
+
+// Rounds a child's bounds on one axis outwards to steps from origin.
+void quantizeAxis(float origin, float scale, float min, float max, uint8_t& minStep, uint8_t& maxStep) {
+    uint32_t lo = std::clamp<float>(std::floor((min - origin) / scale), 0.0f, quantizedMaxStep);
+    while (lo > 0 && decodeStep(origin, lo, scale) > min) {
+        lo--;
+    }
+    uint32_t hi = std::clamp<float>(std::ceil((max - origin) / scale), 0.0f, quantizedMaxStep);
+    while (hi < quantizedMaxStep && decodeStep(origin, hi, scale) < max) {
+        hi++;
+    }
+    minStep = lo;
+    maxStep = hi;
+}
+
+// Quantizes wideNodes[wideIndex] into quantizedNodes[quantizedIndex], then its inner children into a
+// block of nodes allocated right after, copying the objects of its leaf children to the end of
+// objects in slot order.
+void quantizeNode(const std::vector<ispc::WideNode>& wideNodes, const ispc::Hittable* sourceObjects,
+                  QuantizedNodes& quantizedNodes, std::vector<ispc::Hittable>& objects, uint32_t wideIndex,
+                  uint32_t quantizedIndex) {
+    const ispc::WideNode& wide = wideNodes[wideIndex];
+    uint32_t n = wide.numChildren;
+
+    float minX = *std::min_element(wide.minX, wide.minX + n);
+    float minY = *std::min_element(wide.minY, wide.minY + n);
+    float minZ = *std::min_element(wide.minZ, wide.minZ + n);
+    int exponentX = quantizedExponent(minX, *std::max_element(wide.maxX, wide.maxX + n));
+    int exponentY = quantizedExponent(minY, *std::max_element(wide.maxY, wide.maxY + n));
+    int exponentZ = quantizedExponent(minZ, *std::max_element(wide.maxZ, wide.maxZ + n));
+
+    ispc::QuantizedNode node = {};
+    node.originX = minX;
+    node.originY = minY;
+    node.originZ = minZ;
+    node.exponentX = exponentX;
+    node.exponentY = exponentY;
+    node.exponentZ = exponentZ;
+    node.numChildren = n;
+    node.firstObject = objects.size();
+
+    uint32_t numInner = 0;
+    for (uint32_t c = 0; c < n; c++) {
+        quantizeAxis(minX, exponentScale(exponentX), wide.minX[c], wide.maxX[c], node.minX[c], node.maxX[c]);
+        quantizeAxis(minY, exponentScale(exponentY), wide.minY[c], wide.maxY[c], node.minY[c], node.maxY[c]);
+        quantizeAxis(minZ, exponentScale(exponentZ), wide.minZ[c], wide.maxZ[c], node.minZ[c], node.maxZ[c]);
+        node.count[c] = wide.count[c];
+        if (wide.count[c] == 0) {
+            numInner++;
+        } else {
+            objects.insert(objects.end(), sourceObjects + wide.child[c], sourceObjects + wide.child[c] + wide.count[c]);
+        }
+    }
+
+    node.firstChild = quantizedNodes.size();
+    quantizedNodes.resize(quantizedNodes.size() + numInner);
+    quantizedNodes[quantizedIndex] = node;
+
+    uint32_t next = node.firstChild;
+    for (uint32_t c = 0; c < n; c++) {
+        if (wide.count[c] == 0) {
+            quantizeNode(wideNodes, sourceObjects, quantizedNodes, objects, wide.child[c], next++);
+        }
+    }
+}
+
+// Quantizes a wide BVH. Leaf children of a node need their objects next to each other, so the
+// objects are copied into a new array in that order. A leaf holds at most quantizedMaxStep objects.
+ispc::QuantizedBvh* createQuantizedBVH(const ispc::WideBvh& wideBvh, const std::vector<ispc::WideNode>& wideNodes,
+                                       QuantizedNodes& quantizedNodes, std::vector<ispc::Hittable>& objects) {
+    quantizedNodes.clear();
+    quantizedNodes.reserve(wideNodes.size());
+    quantizedNodes.resize(1);
+    objects.clear();
+    objects.reserve(wideBvh.numObjects);
+    quantizeNode(wideNodes, sceneObject<ispc::Hittable>(wideBvh.objects), quantizedNodes, objects, 0, 0);
+
+    ispc::QuantizedBvh* quantizedBvh = new ispc::QuantizedBvh;
+    quantizedBvh->objects = sceneRef(objects.data());
+    quantizedBvh->numObjects = objects.size();
+    quantizedBvh->nodes = sceneRef(quantizedNodes.data());
+    quantizedBvh->numNodes = quantizedNodes.size();
+    quantizedBvh->bbox = wideBvh.bbox;
+    return quantizedBvh;
+}
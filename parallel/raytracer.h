@@ -44,7 +44,12 @@ enum HittableType {
     SPHERE = 0,
     QUAD = 1,
     NODE = 2,
-    BVH = 3 
+    BVH = 3,
+    WIDE_BVH = 4,
+    COMPACT_BVH = 5,
+    INSTANCE = 6,
+    QUANTIZED_BVH = 7,
+    TRIANGLE = 8 
 };
 #endif
 
@@ -74,11 +79,20 @@ enum MaterialType {
 #ifndef __ISPC_STRUCT_Bvh__
 #define __ISPC_STRUCT_Bvh__
 struct Bvh {
-    struct Hittable * objects;
-    struct Node * nodes;
+    int64_t objects;
+    int64_t nodes;
+    int64_t leaves;
+    int64_t spheres;
+    int64_t quads;
+    int64_t sphereBlocks;
+    int64_t quadBlocks;
     uint32_t numNodes;
     uint32_t numObjects;
     uint32_t root;
+    uint32_t numSpheres;
+    uint32_t numQuads;
+    uint32_t numSphereBlocks;
+    uint32_t numQuadBlocks;
 };
 #endif
 
@@ -86,7 +100,7 @@ struct Bvh {
 #define __ISPC_STRUCT_Hittable__
 struct Hittable {
     enum HittableType type;
-    void * object;
+    int64_t object;
 };
 #endif
 
@@ -150,6 +164,183 @@ struct Sphere {
 };
 #endif
 
+#ifndef __ISPC_STRUCT_CompactBvh__
+#define __ISPC_STRUCT_CompactBvh__
+struct CompactBvh {
+    int64_t objects;
+    int64_t nodes;
+    uint32_t numNodes;
+    uint32_t numObjects;
+};
+#endif
+
+#ifndef __ISPC_STRUCT_CompactNode__
+#define __ISPC_STRUCT_CompactNode__
+struct CompactNode {
+    float minX;
+    float minY;
+    float minZ;
+    float maxX;
+    float maxY;
+    float maxZ;
+    uint32_t offset;
+    uint32_t count;
+};
+#endif
+
+#ifndef __ISPC_STRUCT_WideBvh__
+#define __ISPC_STRUCT_WideBvh__
+struct WideBvh {
+    int64_t objects;
+    int64_t nodes;
+    uint32_t numNodes;
+    uint32_t numObjects;
+    struct aabb bbox;
+};
+#endif
+
+#ifndef __ISPC_STRUCT_WideNode__
+#define __ISPC_STRUCT_WideNode__
+struct WideNode {
+    float minX[8];
+    float minY[8];
+    float minZ[8];
+    float maxX[8];
+    float maxY[8];
+    float maxZ[8];
+    uint32_t child[8];
+    uint32_t count[8];
+    uint32_t numChildren;
+};
+#endif
+
+#ifndef __ISPC_STRUCT_Affine__
+#define __ISPC_STRUCT_Affine__
+struct Affine {
+    struct float3  x;
+    struct float3  y;
+    struct float3  z;
+    struct float3  p;
+};
+#endif
+
+#ifndef __ISPC_STRUCT_Instance__
+#define __ISPC_STRUCT_Instance__
+struct Instance {
+    struct Hittable object;
+    struct Affine worldToObject;
+    struct Affine objectToWorld;
+    struct aabb bbox;
+};
+#endif
+
+#ifndef __ISPC_STRUCT_QuantizedBvh__
+#define __ISPC_STRUCT_QuantizedBvh__
+struct QuantizedBvh {
+    int64_t objects;
+    int64_t nodes;
+    uint32_t numNodes;
+    uint32_t numObjects;
+    struct aabb bbox;
+};
+#endif
+
+#ifndef __ISPC_STRUCT_QuantizedNode__
+#define __ISPC_STRUCT_QuantizedNode__
+struct QuantizedNode {
+    float originX;
+    float originY;
+    float originZ;
+    int8_t exponentX;
+    int8_t exponentY;
+    int8_t exponentZ;
+    uint8_t numChildren;
+    uint32_t firstChild;
+    uint32_t firstObject;
+    uint8_t count[8];
+    uint8_t minX[8];
+    uint8_t minY[8];
+    uint8_t minZ[8];
+    uint8_t maxX[8];
+    uint8_t maxY[8];
+    uint8_t maxZ[8];
+};
+#endif
+
+#ifndef __ISPC_STRUCT_Ray__
+#define __ISPC_STRUCT_Ray__
+struct Ray {
+    struct float3  origin;
+    struct float3  direction;
+};
+#endif
+
+#ifndef __ISPC_STRUCT_LeafPrimitives__
+#define __ISPC_STRUCT_LeafPrimitives__
+struct LeafPrimitives {
+    uint32_t firstSphere;
+    uint32_t numSpheres;
+    uint32_t firstSphereBlock;
+    uint32_t firstQuad;
+    uint32_t numQuads;
+    uint32_t firstQuadBlock;
+};
+#endif
+
+#ifndef __ISPC_STRUCT_SphereBlock__
+#define __ISPC_STRUCT_SphereBlock__
+struct SphereBlock {
+    float centerX[8];
+    float centerY[8];
+    float centerZ[8];
+    float radius[8];
+};
+#endif
+
+#ifndef __ISPC_STRUCT_QuadBlock__
+#define __ISPC_STRUCT_QuadBlock__
+struct QuadBlock {
+    float QX[8];
+    float QY[8];
+    float QZ[8];
+    float uX[8];
+    float uY[8];
+    float uZ[8];
+    float vX[8];
+    float vY[8];
+    float vZ[8];
+    float normalX[8];
+    float normalY[8];
+    float normalZ[8];
+    float D[8];
+    float wX[8];
+    float wY[8];
+    float wZ[8];
+};
+#endif
+
+#ifndef __ISPC_STRUCT_TriangleMesh__
+#define __ISPC_STRUCT_TriangleMesh__
+struct TriangleMesh {
+    int64_t x;
+    int64_t y;
+    int64_t z;
+    int64_t indices;
+    uint32_t numVertices;
+    uint32_t numTriangles;
+    struct Material mat;
+    struct aabb bbox;
+};
+#endif
+
+#ifndef __ISPC_STRUCT_Triangle__
+#define __ISPC_STRUCT_Triangle__
+struct Triangle {
+    int64_t mesh;
+    uint32_t index;
+};
+#endif
+
 #ifndef __ISPC_STRUCT_Camera__
 #define __ISPC_STRUCT_Camera__
 struct Camera {
@@ -185,7 +376,7 @@ struct Image {
 #ifndef __ISPC_STRUCT_HittableList__
 #define __ISPC_STRUCT_HittableList__
 struct HittableList {
-    struct Hittable * objects;
+    int64_t objects;
     struct aabb bbox;
     int32_t numObjects;
 };
@@ -198,11 +389,36 @@ struct HittableList {
 #if defined(__cplusplus) && (! defined(__ISPC_NO_EXTERN_C) || !__ISPC_NO_EXTERN_C )
 extern "C" {
 #endif // __cplusplus
+#if defined(__cplusplus)
+    extern void closestHit(const struct HittableList &hittables, const struct Ray * rays, const float * tMax, float * t, int32_t count);
+#else
+    extern void closestHit(const struct HittableList *hittables, const struct Ray * rays, const float * tMax, float * t, int32_t count);
+#endif // closestHit function declaraion
 #if defined(__cplusplus)
     extern void dummyBVH(struct Bvh &bvh);
 #else
     extern void dummyBVH(struct Bvh *bvh);
 #endif // dummyBVH function declaraion
+#if defined(__cplusplus)
+    extern void dummyCompactBVH(struct CompactBvh &bvh);
+#else
+    extern void dummyCompactBVH(struct CompactBvh *bvh);
+#endif // dummyCompactBVH function declaraion
+#if defined(__cplusplus)
+    extern void dummyCompactNode(struct CompactNode &node);
+#else
+    extern void dummyCompactNode(struct CompactNode *node);
+#endif // dummyCompactNode function declaraion
+#if defined(__cplusplus)
+    extern void dummyInstance(struct Instance &instance);
+#else
+    extern void dummyInstance(struct Instance *instance);
+#endif // dummyInstance function declaraion
+#if defined(__cplusplus)
+    extern void dummyLeafPrimitives(struct LeafPrimitives &leaf, struct SphereBlock &spheres, struct QuadBlock &quads);
+#else
+    extern void dummyLeafPrimitives(struct LeafPrimitives *leaf, struct SphereBlock *spheres, struct QuadBlock *quads);
+#endif // dummyLeafPrimitives function declaraion
 #if defined(__cplusplus)
     extern void dummyNode(struct Node &node);
 #else
@@ -213,11 +429,36 @@ extern "C" {
 #else
     extern void dummyQuad(struct Quad *quad);
 #endif // dummyQuad function declaraion
+#if defined(__cplusplus)
+    extern void dummyQuantizedBVH(struct QuantizedBvh &bvh);
+#else
+    extern void dummyQuantizedBVH(struct QuantizedBvh *bvh);
+#endif // dummyQuantizedBVH function declaraion
+#if defined(__cplusplus)
+    extern void dummyQuantizedNode(struct QuantizedNode &node);
+#else
+    extern void dummyQuantizedNode(struct QuantizedNode *node);
+#endif // dummyQuantizedNode function declaraion
 #if defined(__cplusplus)
     extern void dummySphere(struct Sphere &sphere);
 #else
     extern void dummySphere(struct Sphere *sphere);
 #endif // dummySphere function declaraion
+#if defined(__cplusplus)
+    extern void dummyTriangle(struct TriangleMesh &mesh, struct Triangle &triangle);
+#else
+    extern void dummyTriangle(struct TriangleMesh *mesh, struct Triangle *triangle);
+#endif // dummyTriangle function declaraion
+#if defined(__cplusplus)
+    extern void dummyWideBVH(struct WideBvh &bvh);
+#else
+    extern void dummyWideBVH(struct WideBvh *bvh);
+#endif // dummyWideBVH function declaraion
+#if defined(__cplusplus)
+    extern void dummyWideNode(struct WideNode &node);
+#else
+    extern void dummyWideNode(struct WideNode *node);
+#endif // dummyWideNode function declaraion
 #if defined(__cplusplus)
     extern void initQuad(struct Quad &quad);
 #else
@@ -228,6 +469,11 @@ extern "C" {
 #else
     extern void initialize(struct Camera *cam);
 #endif // initialize function declaraion
+#if defined(__cplusplus)
+    extern void occluded(const struct HittableList &hittables, const struct Ray * rays, const float * tMax, bool * result, int32_t count);
+#else
+    extern void occluded(const struct HittableList *hittables, const struct Ray * rays, const float * tMax, bool * result, int32_t count);
+#endif // occluded function declaraion
 #if defined(__cplusplus)
     extern void renderImage(struct Image &image, struct Camera &cam, const struct HittableList &hittables);
 #else
@@ -238,6 +484,11 @@ extern "C" {
 #else
     extern void renderImageWithPackets(struct Image *image, struct Camera *cam, const struct HittableList *hittables);
 #endif // renderImageWithPackets function declaraion
+#if defined(__cplusplus)
+    extern void setSceneBase(int64_t base);
+#else
+    extern void setSceneBase(int64_t base);
+#endif // setSceneBase function declaraion
 #if defined(__cplusplus) && (! defined(__ISPC_NO_EXTERN_C) || !__ISPC_NO_EXTERN_C )
 } /* end extern C */
 #endif // __cplusplus
@@ -18,14 +18,14 @@ void writePPMImage(ispc::Image& image, int width, int height, const char* filena
 
 // Render scene
 
-void render(ispc::Camera* camera, ispc::HittableList* hittableList, bool usePackets) {
+void renderToFile(ispc::Camera* camera, ispc::HittableList* hittableList, bool usePackets, const char* filename) {
     ispc::Image image;
     image.R = new int[camera->imageWidth * camera->imageHeight];
     image.G = new int[camera->imageWidth * camera->imageHeight];
     image.B = new int[camera->imageWidth * camera->imageHeight];
 
-    std::chrono::steady_clock::time_point start;
-    std::chrono::steady_clock::time_point end;
+    std::chrono::high_resolution_clock::time_point start;
+    std::chrono::high_resolution_clock::time_point end;
     std::cout << "Rendering image..." << std::endl;
     if (usePackets) {
         start = std::chrono::high_resolution_clock::now();
@@ -39,11 +39,53 @@ void render(ispc::Camera* camera, ispc::HittableList* hittableList, bool usePack
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
     std::cout << "Time taken by function: " << duration.count() << " milliseconds" << std::endl;
 
-    writePPMImage(image, camera->imageWidth, camera->imageHeight, "image.ppm");
+    writePPMImage(image, camera->imageWidth, camera->imageHeight, filename);
 
     delete[] image.R;
     delete[] image.G;
     delete[] image.B;
+}
+
+// Checks the any-hit query against the closest hit on a ray through the centre of every pixel:
+// occluded has to find something exactly where the closest hit is nearer than tMax. tMax is drawn
+// up to twice the distance to the focal plane, which the ray direction spans, so both answers come up.
+void checkOcclusion(const ispc::Camera& camera, const ispc::HittableList& hittableList) {
+    int count = camera.imageWidth * camera.imageHeight;
+    std::vector<ispc::Ray> rays(count);
+    std::vector<float> tMax(count);
+    std::vector<float> noLimit(count, FLT_MAX);
+    std::vector<float> t(count);
+    bool* occluded = new bool[count];
+
+    for (int j = 0; j < camera.imageHeight; j++) {
+        for (int i = 0; i < camera.imageWidth; i++) {
+            ispc::Ray& ray = rays[j * camera.imageWidth + i];
+            ispc::float3 pixel = camera.pixel00Location;
+            for (int k = 0; k < 3; k++) {
+                pixel.v[k] += i * camera.pixelDeltaU.v[k] + j * camera.pixelDeltaV.v[k];
+                ray.direction.v[k] = pixel.v[k] - camera.center.v[k];
+            }
+            ray.origin = camera.center;
+            tMax[j * camera.imageWidth + i] = 2.0f * rand() / RAND_MAX;
+        }
+    }
+
+    ispc::closestHit(hittableList, rays.data(), noLimit.data(), t.data(), count);
+    ispc::occluded(hittableList, rays.data(), tMax.data(), occluded, count);
+
+    int mismatches = 0;
+    int numOccluded = 0;
+    for (int i = 0; i < count; i++) {
+        mismatches += occluded[i] != (t[i] < tMax[i]);
+        numOccluded += occluded[i];
+    }
+    std::cout << "Occlusion check: " << numOccluded << " of " << count << " rays occluded, " << mismatches
+              << " disagree with the closest hit" << std::endl;
+    delete[] occluded;
+}
+
+void render(ispc::Camera* camera, ispc::HittableList* hittableList, bool usePackets) {
+    renderToFile(camera, hittableList, usePackets, "image.ppm");
     delete camera;
     delete hittableList;
 }
\ No newline at end of file
@@ -0,0 +1,416 @@
+#pragma once
+
+#include "bvh.h"
+#include "raytracer.h"
+#include "taskUtils.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Spatial split BVH construction (Stich et al., "Spatial Splits in Bounding Volume Hierarchies")
+//
+// Huge primitives such as the Cornell box walls or the ground sphere overlap every node an object
+// split can place them in. The spatial split builder may instead cut a reference in two at a
+// plane, clip each half to the primitive, and put a copy in both children. Leaves then index into
+// an object array that contains those copies.
+
+const int sbvhNumSpatialBins = 32;
+
+// Spatial splits are only tried when the children of the best object split overlap by more than
+// this fraction of the root surface area.
+const float sbvhOverlapThreshold = 1e-5f;
+
+// Duplicated references allowed, as a fraction of the number of objects.
+const float sbvhDuplicationBudget = 1.0f;
+
+// No spatial splits below this depth, so a run of splits that all straddle cannot go on forever.
+const int sbvhMaxSpatialDepth = 48;
+
+ispc::interval& getAxisRef(ispc::aabb& bbox, int axis) {
+    switch (axis) {
+    case 0:
+        return bbox.x;
+    case 1:
+        return bbox.y;
+    default:
+        return bbox.z;
+    }
+}
+
+ispc::aabb intersectAABB(ispc::aabb a, ispc::aabb b) {
+    ispc::aabb box;
+    box.x = ispc::interval{std::max(a.x.min, b.x.min), std::min(a.x.max, b.x.max)};
+    box.y = ispc::interval{std::max(a.y.min, b.y.min), std::min(a.y.max, b.y.max)};
+    box.z = ispc::interval{std::max(a.z.min, b.z.min), std::min(a.z.max, b.z.max)};
+    return box;
+}
+
+bool isEmpty(ispc::aabb box) { return box.x.min > box.x.max || box.y.min > box.y.max || box.z.min > box.z.max; }
+
+// Bounds of the part of a sphere between lo and hi along the axis.
+ispc::aabb clipSphere(const ispc::Sphere& sphere, int axis, float lo, float hi) {
+    float c = sphere.center.v[axis];
+    float r = sphere.radius;
+    float start = std::max(lo, c - r);
+    float end = std::min(hi, c + r);
+    if (start > end) {
+        return emptyAABB();
+    }
+
+    // The cross section is widest where the slab comes closest to the center.
+    float d = std::clamp(c, start, end) - c;
+    float crossRadius = std::sqrt(std::max(r * r - d * d, 0.0f));
+
+    ispc::aabb box;
+    for (int a = 0; a < 3; a++) {
+        getAxisRef(box, a) = ispc::interval{sphere.center.v[a] - crossRadius, sphere.center.v[a] + crossRadius};
+    }
+    getAxisRef(box, axis) = ispc::interval{start, end};
+    return box;
+}
+
+// Bounds of the part of a convex polygon between lo and hi along the axis: the corners inside the
+// slab plus the points where the edges cross its planes.
+ispc::aabb clipPolygon(const ispc::float3* corners, int numCorners, int axis, float lo, float hi) {
+    ispc::aabb box = emptyAABB();
+    for (int i = 0; i < numCorners; i++) {
+        ispc::float3 p = corners[i];
+        ispc::float3 q = corners[(i + 1) % numCorners];
+        float pa = p.v[axis];
+        float qa = q.v[axis];
+
+        if (lo <= pa && pa <= hi) {
+            box = growAABB(box, p);
+        }
+        for (float plane : {lo, hi}) {
+            if ((pa < plane) != (qa < plane)) {
+                float t = (plane - pa) / (qa - pa);
+                ispc::float3 crossing;
+                for (int a = 0; a < 3; a++) {
+                    crossing.v[a] = p.v[a] + t * (q.v[a] - p.v[a]);
+                }
+                crossing.v[axis] = plane;
+                box = growAABB(box, crossing);
+            }
+        }
+    }
+
+    return isEmpty(box) ? box : padAABB(box);
+}
+
+ispc::aabb clipQuad(const ispc::Quad& quad, int axis, float lo, float hi) {
+    ispc::float3 corners[4] = {quad.Q, add(quad.Q, quad.u), add(add(quad.Q, quad.u), quad.v), add(quad.Q, quad.v)};
+    return clipPolygon(corners, 4, axis, lo, hi);
+}
+
+ispc::aabb clipTriangle(const ispc::Triangle& triangle, int axis, float lo, float hi) {
+    const ispc::TriangleMesh& mesh = *sceneObject<ispc::TriangleMesh>(triangle.mesh);
+    const uint32_t* indices = sceneObject<uint32_t>(mesh.indices) + 3 * triangle.index;
+    ispc::float3 corners[3] = {meshVertex(mesh, indices[0]), meshVertex(mesh, indices[1]),
+                               meshVertex(mesh, indices[2])};
+    return clipPolygon(corners, 3, axis, lo, hi);
+}
+
+// Bounds of the part of ref's primitive between lo and hi along the axis, never larger than the
+// reference itself.
+ispc::aabb clipReference(const ispc::Hittable& object, const PrimitiveRef& ref, int axis, float lo, float hi) {
+    ispc::aabb box;
+    switch (object.type) {
+    case ispc::HittableType::SPHERE:
+        box = clipSphere(*sceneObject<ispc::Sphere>(object.object), axis, lo, hi);
+        break;
+    case ispc::HittableType::QUAD:
+        box = clipQuad(*sceneObject<ispc::Quad>(object.object), axis, lo, hi);
+        break;
+    case ispc::HittableType::TRIANGLE:
+        box = clipTriangle(*sceneObject<ispc::Triangle>(object.object), axis, lo, hi);
+        break;
+    default:
+        box = ref.bbox;
+        getAxisRef(box, axis) = ispc::interval{lo, hi};
+        break;
+    }
+    return intersectAABB(box, ref.bbox);
+}
+
+struct SpatialBin {
+    ispc::aabb bbox;
+    uint32_t enter;
+    uint32_t exit;
+};
+
+struct SpatialSplit {
+    float cost;
+    int axis;
+    float position;
+};
+
+// Chops every reference into the spatial bins it spans, growing each bin by the clipped piece, and
+// sweeps the bins for the cheapest plane. References are counted where they enter and exit.
+SpatialSplit findSpatialSplit(const std::vector<ispc::Hittable>& objects, const std::vector<PrimitiveRef>& refs,
+                              const ispc::aabb& nodeBox) {
+    SpatialSplit best = {std::numeric_limits<float>::max(), -1, 0.0f};
+    float parentArea = surfaceArea(nodeBox);
+
+    for (int axis = 0; axis < 3; axis++) {
+        ispc::interval extent = getAxis(nodeBox, axis);
+        float binWidth = intervalSize(extent) / sbvhNumSpatialBins;
+        if (binWidth <= 0.0f) {
+            continue;
+        }
+        float scale = 1.0f / binWidth;
+
+        SpatialBin bins[sbvhNumSpatialBins];
+        for (SpatialBin& bin : bins) {
+            bin = {emptyAABB(), 0, 0};
+        }
+
+        for (const PrimitiveRef& ref : refs) {
+            ispc::interval refExtent = getAxis(ref.bbox, axis);
+            int first = std::clamp((int)((refExtent.min - extent.min) * scale), 0, sbvhNumSpatialBins - 1);
+            int last = std::clamp((int)((refExtent.max - extent.min) * scale), first, sbvhNumSpatialBins - 1);
+
+            if (first == last) {
+                bins[first].bbox = createAABB(bins[first].bbox, ref.bbox);
+            } else {
+                for (int b = first; b <= last; b++) {
+                    float lo = extent.min + b * binWidth;
+                    float hi = b == sbvhNumSpatialBins - 1 ? extent.max : lo + binWidth;
+                    ispc::aabb piece = clipReference(objects[ref.index], ref, axis, lo, hi);
+                    if (!isEmpty(piece)) {
+                        bins[b].bbox = createAABB(bins[b].bbox, piece);
+                    }
+                }
+            }
+            bins[first].enter++;
+            bins[last].exit++;
+        }
+
+        float rightArea[sbvhNumSpatialBins];
+        uint32_t rightCount[sbvhNumSpatialBins];
+        ispc::aabb box = emptyAABB();
+        uint32_t count = 0;
+        for (int b = sbvhNumSpatialBins - 1; b > 0; b--) {
+            box = createAABB(box, bins[b].bbox);
+            count += bins[b].exit;
+            rightArea[b] = isEmpty(box) ? 0.0f : surfaceArea(box);
+            rightCount[b] = count;
+        }
+
+        box = emptyAABB();
+        count = 0;
+        for (int b = 1; b < sbvhNumSpatialBins; b++) {
+            box = createAABB(box, bins[b - 1].bbox);
+            count += bins[b - 1].enter;
+            if (count == 0 || rightCount[b] == 0) {
+                continue;
+            }
+            float cost = bvhTraversalCost +
+                         bvhIntersectionCost * (surfaceArea(box) * count + rightArea[b] * rightCount[b]) / parentArea;
+            if (cost < best.cost) {
+                best = {cost, axis, extent.min + b * binWidth};
+            }
+        }
+    }
+
+    return best;
+}
+
+PrimitiveRef clippedRef(const PrimitiveRef& ref, ispc::aabb box) { return PrimitiveRef{box, center(box), ref.index}; }
+
+// Sends every reference to the side(s) of the plane it touches. A straddling reference is split
+// in two unless moving it whole into one child is cheaper ("reference unsplitting").
+void partitionSpatial(const std::vector<ispc::Hittable>& objects, const std::vector<PrimitiveRef>& refs,
+                      const SpatialSplit& split, std::vector<PrimitiveRef>& left, std::vector<PrimitiveRef>& right) {
+    ispc::aabb leftBox = emptyAABB();
+    ispc::aabb rightBox = emptyAABB();
+    std::vector<const PrimitiveRef*> straddling;
+
+    for (const PrimitiveRef& ref : refs) {
+        ispc::interval extent = getAxis(ref.bbox, split.axis);
+        if (extent.max <= split.position) {
+            left.push_back(ref);
+            leftBox = createAABB(leftBox, ref.bbox);
+        } else if (extent.min >= split.position) {
+            right.push_back(ref);
+            rightBox = createAABB(rightBox, ref.bbox);
+        } else {
+            straddling.push_back(&ref);
+        }
+    }
+
+    for (const PrimitiveRef* ref : straddling) {
+        float lowest = std::numeric_limits<float>::lowest();
+        float highest = std::numeric_limits<float>::max();
+        ispc::aabb leftPiece = clipReference(objects[ref->index], *ref, split.axis, lowest, split.position);
+        ispc::aabb rightPiece = clipReference(objects[ref->index], *ref, split.axis, split.position, highest);
+
+        if (isEmpty(rightPiece)) {
+            left.push_back(*ref);
+            leftBox = createAABB(leftBox, ref->bbox);
+            continue;
+        }
+        if (isEmpty(leftPiece)) {
+            right.push_back(*ref);
+            rightBox = createAABB(rightBox, ref->bbox);
+            continue;
+        }
+
+        size_t leftCount = left.size();
+        size_t rightCount = right.size();
+        ispc::aabb splitLeft = createAABB(leftBox, leftPiece);
+        ispc::aabb splitRight = createAABB(rightBox, rightPiece);
+        ispc::aabb wholeLeft = createAABB(leftBox, ref->bbox);
+        ispc::aabb wholeRight = createAABB(rightBox, ref->bbox);
+
+        float splitCost = surfaceArea(splitLeft) * (leftCount + 1) + surfaceArea(splitRight) * (rightCount + 1);
+        float leftCost = surfaceArea(wholeLeft) * (leftCount + 1) + surfaceArea(rightBox) * rightCount;
+        float rightCost = surfaceArea(leftBox) * leftCount + surfaceArea(wholeRight) * (rightCount + 1);
+
+        if (leftCost < splitCost && leftCost <= rightCost) {
+            left.push_back(*ref);
+            leftBox = wholeLeft;
+        } else if (rightCost < splitCost) {
+            right.push_back(*ref);
+            rightBox = wholeRight;
+        } else {
+            left.push_back(clippedRef(*ref, leftPiece));
+            right.push_back(clippedRef(*ref, rightPiece));
+            leftBox = splitLeft;
+            rightBox = splitRight;
+        }
+    }
+}
+
+// Shared state of one build. The number of references is not known up front, so nodes and leaf
+// references go into arrays sized for the full duplication budget, claimed with atomic adds.
+struct SbvhContext {
+    const std::vector<ispc::Hittable>& objects;
+    std::vector<ispc::Node>& nodes;
+    std::vector<PrimitiveRef>& leafRefs;
+    std::atomic<uint32_t> nodeCount;
+    std::atomic<uint32_t> leafRefCount;
+    std::atomic<int64_t> duplicates;
+    int64_t maxDuplicates;
+    float rootArea;
+    uint32_t maxLeafSize;
+};
+
+// Claims room for extra references from the duplication budget.
+bool reserveDuplicates(SbvhContext& ctx, int64_t extra) {
+    if (ctx.duplicates.fetch_add(extra) + extra <= ctx.maxDuplicates) {
+        return true;
+    }
+    ctx.duplicates.fetch_sub(extra);
+    return false;
+}
+
+void writeLeaf(SbvhContext& ctx, size_t nodeIndex, const std::vector<PrimitiveRef>& refs, const ispc::aabb& box) {
+    size_t start = ctx.leafRefCount.fetch_add(refs.size());
+    std::copy(refs.begin(), refs.end(), ctx.leafRefs.begin() + start);
+    writeNode(ctx.nodes, nodeIndex, box, start, refs.size(), 0, 0);
+}
+
+void constructSBVH(SbvhContext& ctx, size_t nodeIndex, std::vector<PrimitiveRef>& refs, const Bounds& bounds,
+                   int depth) {
+    size_t size = refs.size();
+
+    if (size == 1) {
+        writeLeaf(ctx, nodeIndex, refs, bounds.bbox);
+        return;
+    }
+
+    Split objectSplit = findBinnedSplit(refs, 0, size, bounds);
+
+    // Partition by the object split first; its overlap decides whether a spatial split is worth
+    // looking for.
+    size_t middleIndex = size / 2;
+    if (objectSplit.axis >= 0) {
+        ispc::interval extent = getAxis(bounds.centroidBox, objectSplit.axis);
+        float scale = bvhNumBins / intervalSize(extent);
+        auto predicate = [&](const PrimitiveRef& ref) {
+            return binIndex(ref.centroid.v[objectSplit.axis], extent.min, scale) < objectSplit.bin;
+        };
+        middleIndex = std::partition(refs.begin(), refs.end(), predicate) - refs.begin();
+    }
+    Bounds leftBounds = computeBounds(refs, 0, middleIndex);
+    Bounds rightBounds = computeBounds(refs, middleIndex, size);
+
+    float bestCost = objectSplit.cost;
+    SpatialSplit spatialSplit = {std::numeric_limits<float>::max(), -1, 0.0f};
+    ispc::aabb overlap = intersectAABB(leftBounds.bbox, rightBounds.bbox);
+    bool overlapping = objectSplit.axis < 0 || (!isEmpty(overlap) && surfaceArea(overlap) > sbvhOverlapThreshold * ctx.rootArea);
+    if (overlapping && depth < sbvhMaxSpatialDepth && ctx.duplicates.load() < ctx.maxDuplicates) {
+        spatialSplit = findSpatialSplit(ctx.objects, refs, bounds.bbox);
+        bestCost = std::min(bestCost, spatialSplit.cost);
+    }
+
+    float leafCost = bvhIntersectionCost * size;
+    if (size <= ctx.maxLeafSize && leafCost <= bestCost) {
+        writeLeaf(ctx, nodeIndex, refs, bounds.bbox);
+        return;
+    }
+
+    std::vector<PrimitiveRef> left;
+    std::vector<PrimitiveRef> right;
+    if (spatialSplit.axis >= 0 && spatialSplit.cost < objectSplit.cost) {
+        partitionSpatial(ctx.objects, refs, spatialSplit, left, right);
+        bool progress = left.size() < size && right.size() < size;
+        if (!progress || !reserveDuplicates(ctx, left.size() + right.size() - size)) {
+            left.clear();
+            right.clear();
+        }
+    }
+    if (left.empty()) {
+        left.assign(refs.begin(), refs.begin() + middleIndex);
+        right.assign(refs.begin() + middleIndex, refs.end());
+    } else {
+        leftBounds = computeBounds(left, 0, left.size());
+        rightBounds = computeBounds(right, 0, right.size());
+    }
+    std::vector<PrimitiveRef>().swap(refs);
+
+    size_t leftIndex = ctx.nodeCount.fetch_add(2);
+    size_t rightIndex = leftIndex + 1;
+    writeNode(ctx.nodes, nodeIndex, bounds.bbox, 0, size, leftIndex, rightIndex);
+
+    if (size < bvhParallelSubtreeSize) {
+        constructSBVH(ctx, leftIndex, left, leftBounds, depth + 1);
+        constructSBVH(ctx, rightIndex, right, rightBounds, depth + 1);
+        return;
+    }
+
+    launchTasks(2, [&](int child, int) {
+        if (child == 0) {
+            constructSBVH(ctx, leftIndex, left, leftBounds, depth + 1);
+        } else {
+            constructSBVH(ctx, rightIndex, right, rightBounds, depth + 1);
+        }
+    });
+}
+
+ispc::Bvh* createSBVH(std::vector<ispc::Hittable>& objects, std::vector<ispc::Node>& nodes, const uint32_t maxLeafSize,
+                      BvhPhaseTimes* times = nullptr) {
+    std::vector<PrimitiveRef> refs = createPrimitiveRefs(objects);
+    Bounds bounds = computeBoundsParallel(refs, 0, refs.size());
+    markPhase(times, "refs");
+
+    int64_t maxDuplicates = (int64_t)(sbvhDuplicationBudget * objects.size());
+    size_t maxRefs = refs.size() + maxDuplicates;
+    std::vector<PrimitiveRef> leafRefs(maxRefs);
+    nodes.resize(std::max<size_t>(2 * maxRefs, 2) - 1);
+
+    SbvhContext ctx{objects, nodes, leafRefs, {1}, {0}, {0}, maxDuplicates, surfaceArea(bounds.bbox),
+                    std::max(maxLeafSize, 1u)};
+    constructSBVH(ctx, 0, refs, bounds, 0);
+    nodes.resize(ctx.nodeCount);
+    leafRefs.resize(ctx.leafRefCount);
+    markPhase(times, "construct");
+
+    std::cout << "SBVH: " << leafRefs.size() << " references to " << objects.size() << " objects" << std::endl;
+    ispc::Bvh* bvh = finishBVH(objects, nodes, leafRefs);
+    markPhase(times, "reorder");
+    return bvh;
+}
@@ -16,60 +16,138 @@ ispc::Camera* initializeCamera(int imageWidth, int samplesPerPixel, int maxDepth
     return camera;
 }
 
+// Contiguous storage for one type of primitive, filled in chunks instead of one allocation per
+// object. A chunk never grows past the size it was reserved with, so hittables, and scenes that move
+// their objects, can keep pointing into it.
+template <typename T>
+struct PrimitiveArena {
+    static const size_t chunkSize = 4096;
+    std::vector<std::vector<T, AlignedAllocator<T>>> chunks;
+
+    T* append(const T& item) {
+        if (chunks.empty() || chunks.back().size() == chunkSize) {
+            chunks.emplace_back();
+            chunks.back().reserve(chunkSize);
+        }
+        chunks.back().push_back(item);
+        return &chunks.back().back();
+    }
+};
+
+// Every sphere and quad of the scene. A BVH copies the ones it holds again in leaf order (see
+// createLeafPrimitives).
+PrimitiveArena<ispc::Sphere> sceneSpheres;
+PrimitiveArena<ispc::Quad> sceneQuads;
+
 ispc::Sphere* createSphere(ispc::float3 center, float radius, ispc::Material* material) {
-    ispc::Sphere* sphere = new ispc::Sphere;
-    sphere->center = center;
-    sphere->radius = radius;
-    sphere->mat = *material;
+    ispc::Sphere sphere;
+    sphere.center = center;
+    sphere.radius = radius;
+    sphere.mat = *material;
     ispc::float3 rvec = ispc::float3{radius, radius, radius};
     ispc::float3 negativeRvec = ispc::float3{-radius, -radius, -radius};
-    sphere->bbox = createAABB(add(center, negativeRvec), add(center, rvec));
-    return sphere;
+    sphere.bbox = createAABB(add(center, negativeRvec), add(center, rvec));
+    return sceneSpheres.append(sphere);
 }
 
 ispc::Quad* createQuad(ispc::float3 Q, ispc::float3 u, ispc::float3 v, ispc::Material* material) {
-    ispc::Quad* quad = new ispc::Quad;
+    ispc::Quad quad;
+    quad.Q = Q;
+    quad.u = u;
+    quad.v = v;
+    quad.mat = *material;
+    quad.bbox = padAABB(createAABB(Q, add(add(Q, u), v)));
+    ispc::initQuad(quad);
+    return sceneQuads.append(quad);
+}
+
+// Move an existing object in place. Its box is updated, but any BVH over it has to be refit (see
+// updateDynamicBVH) before the next render.
+void moveSphere(ispc::Sphere* sphere, ispc::float3 center) {
+    float radius = sphere->radius;
+    sphere->center = center;
+    sphere->bbox =
+        createAABB(add(center, ispc::float3{-radius, -radius, -radius}), add(center, ispc::float3{radius, radius, radius}));
+}
+
+void moveQuad(ispc::Quad* quad, ispc::float3 Q, ispc::float3 u, ispc::float3 v) {
     quad->Q = Q;
     quad->u = u;
     quad->v = v;
-    quad->mat = *material;
     quad->bbox = padAABB(createAABB(Q, add(add(Q, u), v)));
     ispc::initQuad(*quad);
-    return quad;
 }
 
 void createHittable(ispc::HittableType type, void* object, std::vector<ispc::Hittable>& objects) {
-    ispc::Hittable* hittable = new ispc::Hittable;
-    hittable->type = type;
-    hittable->object = object;
-    objects.emplace_back(*hittable);
+    objects.push_back(ispc::Hittable{type, sceneRef(object)});
+}
+
+ispc::TriangleMesh* createTriangleMesh(const MeshBuffers& buffers, ispc::Material* material) {
+    ispc::TriangleMesh* mesh = new ispc::TriangleMesh;
+    mesh->x = sceneRef(buffers.x.data());
+    mesh->y = sceneRef(buffers.y.data());
+    mesh->z = sceneRef(buffers.z.data());
+    mesh->indices = sceneRef(buffers.indices.data());
+    mesh->numVertices = buffers.x.size();
+    mesh->numTriangles = buffers.indices.size() / 3;
+    mesh->mat = *material;
+
+    mesh->bbox = emptyAABB();
+    for (size_t i = 0; i < buffers.x.size(); i++) {
+        mesh->bbox = growAABB(mesh->bbox, ispc::float3{buffers.x[i], buffers.y[i], buffers.z[i]});
+    }
+    return mesh;
+}
+
+// Adds a hittable per triangle of the mesh. triangles holds what they refer to, so it is only
+// resized here.
+void createTriangleHittables(ispc::TriangleMesh* mesh, std::vector<ispc::Triangle>& triangles,
+                             std::vector<ispc::Hittable>& objects) {
+    triangles.resize(mesh->numTriangles);
+    objects.reserve(objects.size() + mesh->numTriangles);
+    for (uint32_t i = 0; i < mesh->numTriangles; i++) {
+        triangles[i] = ispc::Triangle{sceneRef(mesh), i};
+        createHittable(ispc::HittableType::TRIANGLE, (void*)&triangles[i], objects);
+    }
 }
 
 ispc::HittableList* createHittableList(std::vector<ispc::Hittable>& objects) {
     ispc::HittableList* hittableList = new ispc::HittableList;
-    hittableList->objects = objects.data();
+    hittableList->objects = sceneRef(objects.data());
     hittableList->numObjects = objects.size();
 
     for (size_t i = 0; i < objects.size(); i++) {
         switch (objects[i].type) {
         case ispc::HittableType::SPHERE: {
-            ispc::Sphere* sphere = (ispc::Sphere*)objects[i].object;
+            ispc::Sphere* sphere = sceneObject<ispc::Sphere>(objects[i].object);
             hittableList->bbox = createAABB(hittableList->bbox, sphere->bbox);
             break;
         }
         case ispc::HittableType::QUAD: {
-            ispc::Quad* quad = (ispc::Quad*)objects[i].object;
+            ispc::Quad* quad = sceneObject<ispc::Quad>(objects[i].object);
             hittableList->bbox = createAABB(hittableList->bbox, quad->bbox);
             break;
         }
         case ispc::HittableType::NODE: {
-            ispc::Node* node = (ispc::Node*)objects[i].object;
+            ispc::Node* node = sceneObject<ispc::Node>(objects[i].object);
             hittableList->bbox = createAABB(hittableList->bbox, node->bbox);
             break;
         }
         case ispc::HittableType::BVH: {
-            ispc::Bvh* bvh = (ispc::Bvh*)objects[i].object;
-            hittableList->bbox = createAABB(hittableList->bbox, bvh->nodes[bvh->root].bbox);
+            ispc::Bvh* bvh = sceneObject<ispc::Bvh>(objects[i].object);
+            hittableList->bbox = createAABB(hittableList->bbox, sceneObject<ispc::Node>(bvh->nodes)[bvh->root].bbox);
+            break;
+        }
+        case ispc::HittableType::WIDE_BVH: {
+            ispc::WideBvh* bvh = sceneObject<ispc::WideBvh>(objects[i].object);
+            hittableList->bbox = createAABB(hittableList->bbox, bvh->bbox);
+            break;
+        }
+        case ispc::HittableType::COMPACT_BVH:
+        case ispc::HittableType::INSTANCE:
+        case ispc::HittableType::QUANTIZED_BVH:
+        case ispc::HittableType::TRIANGLE: {
+            hittableList->bbox = createAABB(hittableList->bbox, getAABB(objects[i]));
             break;
         }
         }
@@ -84,7 +162,7 @@ ispc::HittableList* createHittableList(ispc::Hittable object) {
     ispc::Hittable* objs = new ispc::Hittable[1];
     objs[0] = object;
 
-    hittableList->objects = objs;
+    hittableList->objects = sceneRef(objs);
     hittableList->numObjects = 1;
 
     auto bbox = getAABB(object);
@@ -93,6 +171,190 @@ ispc::HittableList* createHittableList(ispc::Hittable object) {
     return hittableList;
 }
 
+ispc::Bvh* buildBVH(std::vector<ispc::Hittable>& objects, std::vector<ispc::Node>& nodes, const BvhOptions& options) {
+    // The builders reorder objects, and the SBVH duplicates the split ones, so a tree too deep for
+    // the traversal is rebuilt from the objects as given.
+    std::vector<ispc::Hittable> sourceObjects = objects;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    BvhPhaseTimes times;
+    ispc::Bvh* bvh;
+    switch (options.builder) {
+    case BvhBuilder::LBVH:
+        bvh = createLBVH(objects, nodes, options.maxLeafSize, false, &times);
+        break;
+    case BvhBuilder::LBVH_SAH:
+        bvh = createLBVH(objects, nodes, options.maxLeafSize, true, &times);
+        break;
+    case BvhBuilder::SBVH:
+        bvh = createSBVH(objects, nodes, options.maxLeafSize, &times);
+        break;
+    default:
+        bvh = createBVH(objects, nodes, options.maxLeafSize, &times);
+        break;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    std::cout << "BVH build time: " << duration.count() << " milliseconds (" << nodes.size() << " nodes)" << std::endl;
+
+    if (options.optimizePasses > 0) {
+        times.last = std::chrono::high_resolution_clock::now();
+        optimizeBVH(objects, nodes, bvh, options.optimizePasses);
+        markPhase(&times, "optimize");
+    }
+
+    // Only the binned SAH builder keeps the tree within the traversal stack, and the optimizer may
+    // deepen even its trees.
+    uint32_t depth = bvhDepth(nodes, bvh->root);
+    if (depth > bvhStackSize) {
+        std::cout << "BVH depth " << depth << " exceeds the traversal stack (" << bvhStackSize
+                  << "), rebuilding it with SAH" << std::endl;
+        delete bvh;
+        objects = sourceObjects;
+        bvh = createBVH(objects, nodes, options.maxLeafSize, &times);
+        if (options.optimizePasses > 0) {
+            optimizeBVH(objects, nodes, bvh, options.optimizePasses);
+            depth = bvhDepth(nodes, bvh->root);
+            if (depth > bvhStackSize) {
+                std::cout << "Optimized SAH BVH depth " << depth
+                          << " exceeds the traversal stack too, dropping the optimization" << std::endl;
+                delete bvh;
+                objects = sourceObjects;
+                bvh = createBVH(objects, nodes, options.maxLeafSize, &times);
+            }
+        }
+    }
+
+    if (options.stats) {
+        printBvhStats(std::cout, computeBvhStats(*bvh, nodes), options, times);
+    }
+    return bvh;
+}
+
+// Node arrays the scene's BVH points into. They have to outlive the render.
+struct BvhStorage {
+    std::vector<ispc::Node> nodes;
+    std::vector<ispc::WideNode> wideNodes;
+    CompactNodes compactNodes;
+    QuantizedNodes quantizedNodes;
+    std::vector<ispc::Hittable> quantizedObjects;
+    LeafPrimitiveStorage leafPrimitives;
+};
+
+// Quantizes the tree in storage.nodes by way of a wide tree, 8 wide unless a BVH4 was asked for.
+ispc::QuantizedBvh* quantizeBVH(const ispc::Bvh& bvh, BvhStorage& storage, const BvhOptions& options) {
+    uint32_t width = options.width > 2 ? options.width : wideBvhMaxWidth;
+    ispc::WideBvh* wideBvh = createWideBVH(bvh, storage.nodes, storage.wideNodes, width);
+    ispc::QuantizedBvh* quantizedBvh =
+        createQuantizedBVH(*wideBvh, storage.wideNodes, storage.quantizedNodes, storage.quantizedObjects);
+    delete wideBvh;
+    return quantizedBvh;
+}
+
+// The compact layout if the options ask for it, the binary tree with its leaf primitives otherwise
+ispc::Hittable binaryBVHHittable(ispc::Bvh* bvh, BvhStorage& storage, const BvhOptions& options) {
+    ispc::Hittable root;
+    if (options.compact) {
+        ispc::CompactBvh* compactBvh = createCompactBVH(*bvh, storage.nodes, storage.compactNodes);
+        std::cout << "Compact BVH: " << storage.compactNodes.size() << " nodes" << std::endl;
+        root.type = ispc::HittableType::COMPACT_BVH;
+        root.object = sceneRef(compactBvh);
+    } else {
+        createLeafPrimitives(*bvh, storage.leafPrimitives);
+        std::cout << "Leaf primitives: " << bvh->numSpheres << " spheres in " << bvh->numSphereBlocks << " blocks, "
+                  << bvh->numQuads << " quads in " << bvh->numQuadBlocks << " blocks" << std::endl;
+        root.type = ispc::HittableType::BVH;
+        root.object = sceneRef(bvh);
+    }
+    return root;
+}
+
+// Whether traversing the wide tree in storage.wideNodes stays within its stack. Says so if not.
+bool fitsWideStack(const BvhStorage& storage) {
+    uint32_t entries = wideStackEntries(storage.wideNodes, 0);
+    if (entries <= wideBvhStackSize) {
+        return true;
+    }
+    std::cout << "Wide BVH needs " << entries << " stack entries, more than the traversal's " << wideBvhStackSize
+              << ", rendering the binary tree instead" << std::endl;
+    return false;
+}
+
+// Wraps a BVH built into storage.nodes in the hittable the scene renders, converting it to the
+// quantized, wide or compact layout when the options ask for one. A wide layout whose traversal
+// would overflow its stack falls back to the binary one.
+ispc::Hittable createBVHHittable(ispc::Bvh* bvh, BvhStorage& storage, const BvhOptions& options) {
+    ispc::Hittable root;
+    if (options.quantized) {
+        ispc::QuantizedBvh* quantizedBvh = quantizeBVH(*bvh, storage, options);
+        if (fitsWideStack(storage)) {
+            std::cout << "Quantized BVH: " << storage.quantizedNodes.size() << " nodes, "
+                      << storage.quantizedNodes.size() * sizeof(ispc::QuantizedNode) << " bytes (binary tree: "
+                      << storage.nodes.size() * sizeof(ispc::Node) << " bytes)" << std::endl;
+            root.type = ispc::HittableType::QUANTIZED_BVH;
+            root.object = sceneRef(quantizedBvh);
+            return root;
+        }
+        delete quantizedBvh;
+    } else if (options.width > 2) {
+        ispc::WideBvh* wideBvh = createWideBVH(*bvh, storage.nodes, storage.wideNodes, options.width);
+        if (fitsWideStack(storage)) {
+            std::cout << "Wide BVH: " << storage.wideNodes.size() << " nodes" << std::endl;
+            root.type = ispc::HittableType::WIDE_BVH;
+            root.object = sceneRef(wideBvh);
+            return root;
+        }
+        delete wideBvh;
+    }
+    return binaryBVHHittable(bvh, storage, options);
+}
+
+ispc::Hittable buildBVHHittable(std::vector<ispc::Hittable>& objects, BvhStorage& storage, const BvhOptions& options) {
+    return createBVHHittable(buildBVH(objects, storage.nodes, options), storage, options);
+}
+
+// Regenerates the quantized, wide or compact layout of root, or the leaf primitives of a plain
+// binary tree, after its binary tree was refit or rebuilt. The hittable keeps pointing at the same
+// struct, so the hittable list stays valid, unless a rebuilt tree no longer fits the wide
+// traversal's stack. root then switches to the binary layout, and true says the list needs it.
+bool updateBVHHittable(ispc::Hittable& root, ispc::Bvh* bvh, BvhStorage& storage, const BvhOptions& options) {
+    if (root.type == ispc::HittableType::QUANTIZED_BVH) {
+        ispc::QuantizedBvh* quantizedBvh = quantizeBVH(*bvh, storage, options);
+        bool fits = fitsWideStack(storage);
+        if (fits) {
+            *sceneObject<ispc::QuantizedBvh>(root.object) = *quantizedBvh;
+        }
+        delete quantizedBvh;
+        if (!fits) {
+            delete sceneObject<ispc::QuantizedBvh>(root.object);
+            root = binaryBVHHittable(bvh, storage, options);
+            return true;
+        }
+    } else if (root.type == ispc::HittableType::WIDE_BVH) {
+        ispc::WideBvh* wideBvh = createWideBVH(*bvh, storage.nodes, storage.wideNodes, options.width);
+        bool fits = fitsWideStack(storage);
+        if (fits) {
+            *sceneObject<ispc::WideBvh>(root.object) = *wideBvh;
+        }
+        delete wideBvh;
+        if (!fits) {
+            delete sceneObject<ispc::WideBvh>(root.object);
+            root = binaryBVHHittable(bvh, storage, options);
+            return true;
+        }
+    } else if (root.type == ispc::HittableType::COMPACT_BVH) {
+        ispc::CompactBvh* compactBvh = createCompactBVH(*bvh, storage.nodes, storage.compactNodes);
+        *sceneObject<ispc::CompactBvh>(root.object) = *compactBvh;
+        delete compactBvh;
+    } else if (root.type == ispc::HittableType::BVH) {
+        ispc::Bvh& rootBvh = *sceneObject<ispc::Bvh>(root.object);
+        rootBvh = *bvh;
+        createLeafPrimitives(rootBvh, storage.leafPrimitives);
+    }
+    return false;
+}
+
 ispc::Material* createMaterial(ispc::MaterialType type, ispc::float3 albedo) {
     ispc::Material* material = new ispc::Material;
     material->type = type;
@@ -1,11 +1,85 @@
 #pragma once
+#include "meshLoader.h"
 #include "render.h"
 #include "sceneUtils.h"
+#include "dynamicBvh.h"
+#include <cmath>
+#include <optional>
 
 // Scenes
 
-void randomSpheres(int imageWidth, int samplesPerPixel, int maxDepth, float vfov, bool useBVH, int bvhMaxLeafSize, bool usePackets,
-                   int numSpheres = 11, float zoom = 3.0f) {
+// Renders the scene, unless it was only set up for the BVH statistics, saving a snapshot of it first
+// if one was asked for.
+void renderScene(ispc::Camera* camera, ispc::HittableList* hittableList, const BvhOptions& bvhOptions, bool usePackets) {
+    if (bvhOptions.stats) {
+        delete camera;
+        delete hittableList;
+        return;
+    }
+    if (bvhOptions.snapshot != nullptr) {
+        writeSnapshot(bvhOptions.snapshot, bvhOptions.snapshotKey, *camera, *hittableList);
+    }
+    if (bvhOptions.checkOcclusion) {
+        checkOcclusion(*camera, *hittableList);
+    }
+    render(camera, hittableList, usePackets);
+}
+
+// Renders frames of the small spheres bouncing, refitting the BVH between frames instead of
+// rebuilding the scene.
+void bouncingSpheres(ispc::Camera* camera, std::vector<ispc::Hittable>& objects, const std::vector<ispc::Sphere*>& spheres,
+                     const BvhOptions& bvhOptions, bool usePackets, int frames) {
+    std::vector<ispc::float3> restCenters;
+    for (ispc::Sphere* sphere : spheres) {
+        restCenters.push_back(sphere->center);
+    }
+
+    ispc::HittableList* hittableList;
+    ispc::Hittable root;
+    BvhStorage bvhStorage;
+    std::optional<DynamicBvh> dynamicBvh;
+    if (bvhOptions.enabled) {
+        dynamicBvh.emplace(createDynamicBVH(objects, bvhStorage.nodes, bvhOptions));
+        root = createBVHHittable(dynamicBvh->bvh, bvhStorage, bvhOptions);
+        hittableList = createHittableList(root);
+    } else {
+        hittableList = createHittableList(objects);
+    }
+
+    for (int frame = 0; frame < frames; frame++) {
+        if (frame > 0) {
+            for (size_t i = 0; i < spheres.size(); i++) {
+                ispc::float3 center = restCenters[i];
+                center.v[1] += 0.5f * std::abs(std::sin(0.3f * frame + i));
+                moveSphere(spheres[i], center);
+            }
+        }
+
+        if (frame > 0 && dynamicBvh) {
+            auto start = std::chrono::high_resolution_clock::now();
+            bool rebuilt = updateDynamicBVH(*dynamicBvh);
+            if (updateBVHHittable(root, dynamicBvh->bvh, bvhStorage, bvhOptions)) {
+                sceneObject<ispc::Hittable>(hittableList->objects)[0] = root;
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+
+            auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+            std::cout << "Frame " << frame << ": BVH " << (rebuilt ? "rebuild" : "refit") << " " << duration.count()
+                      << " microseconds, SAH cost " << dynamicBvh->cost << " (" << dynamicBvh->builtCost
+                      << " after the last build)" << std::endl;
+        }
+
+        char filename[32];
+        snprintf(filename, sizeof(filename), "image_%03d.ppm", frame);
+        renderToFile(camera, hittableList, usePackets, filename);
+    }
+
+    delete camera;
+    delete hittableList;
+}
+
+void randomSpheres(int imageWidth, int samplesPerPixel, int maxDepth, float vfov, const BvhOptions& bvhOptions, bool usePackets,
+                   int frames, int numSpheres = 11, float zoom = 3.0f) {
     vfov = 20; // constant for random spheres
 
     auto lookfrom = ispc::float3{13, 2, zoom};
@@ -17,6 +91,7 @@ void randomSpheres(int imageWidth, int samplesPerPixel, int maxDepth, float vfov
         initializeCamera(imageWidth, samplesPerPixel, maxDepth, vfov, 16.0f / 9.0f, lookfrom, lookat, vup, background);
 
     std::vector<ispc::Hittable> objects = std::vector<ispc::Hittable>();
+    std::vector<ispc::Sphere*> smallSpheres;
 
     // ISPC Build Scene code
     ispc::Material* groundMaterial = createMaterial(ispc::MaterialType::LAMBERTIAN, ispc::float3{0.5f, 0.5f, 0.5f});
@@ -43,17 +118,20 @@ void randomSpheres(int imageWidth, int samplesPerPixel, int maxDepth, float vfov
                     sphereMaterial = createMaterial(ispc::MaterialType::LAMBERTIAN, albedo);
                     ispc::Sphere* sphere = createSphere(center, 0.2f, sphereMaterial);
                     createHittable(ispc::HittableType::SPHERE, (void*)sphere, objects);
+                    smallSpheres.push_back(sphere);
                 } else if (choose_mat < 0.95) {
                     // mirror
                     ispc::float3 albedo = ispc::float3{1.0f, 1.0f, 1.0f};
                     sphereMaterial = createMaterial(ispc::MaterialType::MIRROR, albedo);
                     ispc::Sphere* sphere = createSphere(center, 0.2f, sphereMaterial);
                     createHittable(ispc::HittableType::SPHERE, (void*)sphere, objects);
+                    smallSpheres.push_back(sphere);
                 } else {
                     // glass
                     sphereMaterial = createMaterial(ispc::MaterialType::GLASS, ispc::float3{1.0f, 1.0f, 1.0f});
                     ispc::Sphere* sphere = createSphere(center, 0.2f, sphereMaterial);
                     createHittable(ispc::HittableType::SPHERE, (void*)sphere, objects);
+                    smallSpheres.push_back(sphere);
                 }
             }
         }
@@ -71,22 +149,25 @@ void randomSpheres(int imageWidth, int samplesPerPixel, int maxDepth, float vfov
     ispc::Sphere* sphere3 = createSphere(ispc::float3{4.0f, 1.0f, 0.0f}, 1.0f, material3);
     createHittable(ispc::HittableType::SPHERE, (void*)sphere3, objects);
 
+    if (frames > 1 && !bvhOptions.stats) {
+        bouncingSpheres(camera, objects, smallSpheres, bvhOptions, usePackets, frames);
+        return;
+    }
+
     ispc::HittableList* hittableList;
     ispc::Hittable root;
-    std::vector<ispc::Node> nodes;
-    if (useBVH) {
-        ispc::Bvh* bvh = createBVH(objects, nodes, bvhMaxLeafSize);
-        root.type = ispc::HittableType::BVH;
-        root.object = (void*)bvh;
+    BvhStorage bvhStorage;
+    if (bvhOptions.enabled) {
+        root = buildBVHHittable(objects, bvhStorage, bvhOptions);
         hittableList = createHittableList(root);
     } else {
         hittableList = createHittableList(objects);
     }
 
-    render(camera, hittableList, usePackets);
+    renderScene(camera, hittableList, bvhOptions, usePackets);
 }
 
-void cornellBox(int imageWidth, int samplesPerPixel, int maxDepth, float vfov, bool useBVH, int bvhMaxLeafSize, bool usePackets) {
+void cornellBox(int imageWidth, int samplesPerPixel, int maxDepth, float vfov, const BvhOptions& bvhOptions, bool usePackets) {
     vfov = 40; // constant for cornell box
 
     auto lookfrom = ispc::float3{278, 278, -800};
@@ -139,15 +220,157 @@ void cornellBox(int imageWidth, int samplesPerPixel, int maxDepth, float vfov, b
 
     ispc::HittableList* hittableList;
     ispc::Hittable root;
-    std::vector<ispc::Node> nodes;
-    if (useBVH) {
-        ispc::Bvh* bvh = createBVH(objects, nodes, bvhMaxLeafSize);
-        root.type = ispc::HittableType::BVH;
-        root.object = (void*)bvh;
+    BvhStorage bvhStorage;
+    if (bvhOptions.enabled) {
+        root = buildBVHHittable(objects, bvhStorage, bvhOptions);
         hittableList = createHittableList(root);
     } else {
         hittableList = createHittableList(objects);
     }
 
-    render(camera, hittableList, usePackets);
+    renderScene(camera, hittableList, bvhOptions, usePackets);
+}
+
+// A large field of sphere clusters. A few unique clusters are built into bottom-level BVHs once
+// and every tile of the field is an instance of one of them, rotated and moved into place.
+void instancedSpheres(int imageWidth, int samplesPerPixel, int maxDepth, float vfov, const BvhOptions& bvhOptions,
+                      bool usePackets, int gridSize = 64, int clusterSize = 16, float zoom = 30.0f) {
+    vfov = 20; // constant for random spheres
+
+    auto lookfrom = ispc::float3{13, 2, zoom};
+    auto lookat = ispc::float3{0, 0, 0};
+    auto vup = ispc::float3{0, 1, 0};
+    auto background = ispc::float3{0.7f, 0.8f, 1.0f};
+
+    ispc::Camera* camera =
+        initializeCamera(imageWidth, samplesPerPixel, maxDepth, vfov, 16.0f / 9.0f, lookfrom, lookat, vup, background);
+
+    // Bottom level: clusters of small spheres around the origin of their object space
+    const int numClusters = 4;
+    std::vector<std::vector<ispc::Hittable>> clusterObjects(numClusters);
+    std::vector<BvhStorage> clusterStorage(numClusters);
+    std::vector<ispc::Hittable> clusters(numClusters);
+
+    for (int c = 0; c < numClusters; c++) {
+        for (int a = 0; a < clusterSize; a++) {
+            for (int b = 0; b < clusterSize; b++) {
+                float choose_mat = (float)rand() / RAND_MAX;
+                ispc::float3 center = ispc::float3{a - clusterSize / 2 + 0.9f * ((float)rand() / RAND_MAX), 0.2f,
+                                                   b - clusterSize / 2 + 0.9f * ((float)rand() / RAND_MAX)};
+
+                ispc::Material* sphereMaterial;
+                if (choose_mat < 0.8) {
+                    ispc::float3 albedo = ispc::float3{(float)rand() / RAND_MAX, (float)rand() / RAND_MAX,
+                                                       (float)rand() / RAND_MAX};
+                    sphereMaterial = createMaterial(ispc::MaterialType::LAMBERTIAN, albedo);
+                } else if (choose_mat < 0.95) {
+                    sphereMaterial = createMaterial(ispc::MaterialType::MIRROR, ispc::float3{1.0f, 1.0f, 1.0f});
+                } else {
+                    sphereMaterial = createMaterial(ispc::MaterialType::GLASS, ispc::float3{1.0f, 1.0f, 1.0f});
+                }
+                ispc::Sphere* sphere = createSphere(center, 0.2f, sphereMaterial);
+                createHittable(ispc::HittableType::SPHERE, (void*)sphere, clusterObjects[c]);
+            }
+        }
+        clusters[c] = buildBVHHittable(clusterObjects[c], clusterStorage[c], bvhOptions);
+    }
+
+    // Top level: one instance per tile, plus the ground and the three large spheres
+    std::vector<ispc::Hittable> objects = std::vector<ispc::Hittable>();
+
+    for (int i = 0; i < gridSize; i++) {
+        for (int j = 0; j < gridSize; j++) {
+            ispc::float3 tileCenter = ispc::float3{(float)((i - gridSize / 2) * clusterSize), 0.0f,
+                                                   (float)((j - gridSize / 2) * clusterSize)};
+            ispc::Affine objectToWorld = composeAffine(translateAffine(tileCenter), rotateYAffine((rand() % 4) * M_PI / 2));
+            ispc::Instance* instance = createInstance(clusters[rand() % numClusters], objectToWorld);
+            createHittable(ispc::HittableType::INSTANCE, (void*)instance, objects);
+        }
+    }
+
+    // A ground sphere this wide would lose too much precision near its top, so use a quad.
+    float halfWidth = (gridSize / 2 + 1) * clusterSize;
+    ispc::Material* groundMaterial = createMaterial(ispc::MaterialType::LAMBERTIAN, ispc::float3{0.5f, 0.5f, 0.5f});
+    ispc::Quad* ground = createQuad(ispc::float3{-halfWidth, 0.0f, -halfWidth}, ispc::float3{2 * halfWidth, 0.0f, 0.0f},
+                                    ispc::float3{0.0f, 0.0f, 2 * halfWidth}, groundMaterial);
+    createHittable(ispc::HittableType::QUAD, (void*)ground, objects);
+
+    ispc::Material* material1 = createMaterial(ispc::MaterialType::GLASS, ispc::float3{1.0f, 1.0f, 1.0f});
+    ispc::Sphere* sphere1 = createSphere(ispc::float3{0.0f, 1.0f, 0.0f}, 1.0f, material1);
+    createHittable(ispc::HittableType::SPHERE, (void*)sphere1, objects);
+
+    ispc::Material* material2 = createMaterial(ispc::MaterialType::LAMBERTIAN, ispc::float3{0.4f, 0.2f, 0.1f});
+    ispc::Sphere* sphere2 = createSphere(ispc::float3{-4.0f, 1.0f, 0.0f}, 1.0f, material2);
+    createHittable(ispc::HittableType::SPHERE, (void*)sphere2, objects);
+
+    ispc::Material* material3 = createMaterial(ispc::MaterialType::MIRROR, ispc::float3{0.7f, 0.6f, 0.5f});
+    ispc::Sphere* sphere3 = createSphere(ispc::float3{4.0f, 1.0f, 0.0f}, 1.0f, material3);
+    createHittable(ispc::HittableType::SPHERE, (void*)sphere3, objects);
+
+    std::cout << "Instanced spheres: " << (size_t)gridSize * gridSize * clusterSize * clusterSize << " from "
+              << numClusters * clusterSize * clusterSize << " unique spheres" << std::endl;
+
+    ispc::HittableList* hittableList;
+    ispc::Hittable root;
+    BvhStorage bvhStorage;
+    if (bvhOptions.enabled) {
+        root = buildBVHHittable(objects, bvhStorage, bvhOptions);
+        hittableList = createHittableList(root);
+    } else {
+        hittableList = createHittableList(objects);
+    }
+
+    renderScene(camera, hittableList, bvhOptions, usePackets);
+}
+
+// A triangle mesh loaded from a PLY or OBJ file, standing on a ground quad. The camera is placed
+// from the mesh's bounding box, so any model is in frame. Returns false if the mesh cannot be loaded.
+bool triangleMesh(int imageWidth, int samplesPerPixel, int maxDepth, float vfov, const BvhOptions& bvhOptions,
+                  bool usePackets, const char* meshPath) {
+    MeshBuffers buffers;
+    if (!loadMesh(meshPath, buffers)) {
+        return false;
+    }
+
+    ispc::Material* meshMaterial = createMaterial(ispc::MaterialType::LAMBERTIAN, ispc::float3{0.73f, 0.73f, 0.73f});
+    ispc::TriangleMesh* mesh = createTriangleMesh(buffers, meshMaterial);
+    ispc::aabb bbox = mesh->bbox;
+    ispc::float3 middle = center(bbox);
+    float radius = 0.5f * std::sqrt(intervalSize(bbox.x) * intervalSize(bbox.x) +
+                                    intervalSize(bbox.y) * intervalSize(bbox.y) +
+                                    intervalSize(bbox.z) * intervalSize(bbox.z));
+
+    // Far enough back for the bounding sphere to fit the vertical field of view, looking down a little
+    float distance = 1.1f * radius / std::sin(0.5f * vfov * (float)M_PI / 180.0f);
+    auto lookfrom = ispc::float3{middle.v[0] + 0.5f * distance, middle.v[1] + 0.3f * distance,
+                                 middle.v[2] + 0.8f * distance};
+    auto vup = ispc::float3{0, 1, 0};
+    auto background = ispc::float3{0.7f, 0.8f, 1.0f};
+
+    ispc::Camera* camera =
+        initializeCamera(imageWidth, samplesPerPixel, maxDepth, vfov, 16.0f / 9.0f, lookfrom, middle, vup, background);
+
+    std::vector<ispc::Hittable> objects = std::vector<ispc::Hittable>();
+    std::vector<ispc::Triangle> triangles;
+    createTriangleHittables(mesh, triangles, objects);
+
+    float halfWidth = 10.0f * radius;
+    ispc::Material* groundMaterial = createMaterial(ispc::MaterialType::LAMBERTIAN, ispc::float3{0.5f, 0.5f, 0.5f});
+    ispc::Quad* ground = createQuad(ispc::float3{middle.v[0] - halfWidth, bbox.y.min, middle.v[2] - halfWidth},
+                                    ispc::float3{2 * halfWidth, 0.0f, 0.0f}, ispc::float3{0.0f, 0.0f, 2 * halfWidth},
+                                    groundMaterial);
+    createHittable(ispc::HittableType::QUAD, (void*)ground, objects);
+
+    ispc::HittableList* hittableList;
+    ispc::Hittable root;
+    BvhStorage bvhStorage;
+    if (bvhOptions.enabled) {
+        root = buildBVHHittable(objects, bvhStorage, bvhOptions);
+        hittableList = createHittableList(root);
+    } else {
+        hittableList = createHittableList(objects);
+    }
+
+    renderScene(camera, hittableList, bvhOptions, usePackets);
+    return true;
 }
@@ -0,0 +1,311 @@
+#pragma once
+
+#include "bvh.h"
+#include "compactBvh.h"
+#include "leafPrimitives.h"
+#include "raytracer.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+// Scene snapshots
+//
+// A snapshot holds the camera and everything reachable from the hittable list, primitives (with
+// their materials), BVH nodes and instances, in a single file. Every SceneRef in it is an offset
+// from the start of the file, so loading maps the file read only and makes the mapping the scene
+// base (see raytracer.ispc). Nothing is patched after mapping, and processes rendering the same
+// snapshot share its pages.
+
+const char snapshotMagic[8] = {'R', 'T', 'S', 'N', 'A', 'P', 'S', 'H'};
+
+// Bump whenever an exported struct or the file layout changes.
+const uint32_t snapshotVersion = 4;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t fileSize;
+    uint64_t key; // Hash of the settings the scene was built with
+    ispc::Camera camera;
+    ispc::HittableList hittableList;
+};
+
+// Hashes everything on the command line that changes the scene or its BVH, so a snapshot is only
+// reused for the settings that produced it. A mesh is told apart by its path, not its contents.
+uint64_t snapshotKey(int scene, int imageWidth, int samplesPerPixel, int maxDepth, float vfov,
+                     const BvhOptions& options, const char* meshPath) {
+    int32_t values[] = {scene,
+                        imageWidth,
+                        samplesPerPixel,
+                        maxDepth,
+                        (int32_t)(vfov * 1000.0f),
+                        options.enabled,
+                        (int32_t)options.maxLeafSize,
+                        (int32_t)options.builder,
+                        (int32_t)options.width,
+                        options.compact,
+                        options.quantized,
+                        options.optimizePasses};
+
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    const unsigned char* bytes = (const unsigned char*)values;
+    for (size_t i = 0; i < sizeof(values); i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    for (const char* c = meshPath; c != nullptr && *c != 0; c++) {
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+    }
+    return hash;
+}
+
+struct SnapshotWriter {
+    std::vector<char> data;
+    std::unordered_map<int64_t, int64_t> written; // In-memory reference -> file offset
+};
+
+// Appends count items at the given alignment and returns their offset in the file. items may be
+// null when there are none, as for the quads of a scene made of spheres only.
+template <typename T>
+int64_t appendItems(SnapshotWriter& writer, const T* items, size_t count, size_t alignment = alignof(T)) {
+    size_t offset = (writer.data.size() + alignment - 1) / alignment * alignment;
+    writer.data.resize(offset + count * sizeof(T));
+    if (count > 0) {
+        memcpy(writer.data.data() + offset, items, count * sizeof(T));
+    }
+    return offset;
+}
+
+template <typename T>
+T& itemAt(SnapshotWriter& writer, int64_t offset) {
+    return *(T*)(writer.data.data() + offset);
+}
+
+int64_t writeHittables(SnapshotWriter& writer, int64_t objects, size_t count);
+
+// Writes a triangle mesh and its vertex and index buffers once, however many triangles refer to it.
+int64_t writeMesh(SnapshotWriter& writer, int64_t meshRef) {
+    auto found = writer.written.find(meshRef);
+    if (found != writer.written.end()) {
+        return found->second;
+    }
+
+    ispc::TriangleMesh mesh = *sceneObject<ispc::TriangleMesh>(meshRef);
+    mesh.x = appendItems(writer, sceneObject<float>(mesh.x), mesh.numVertices, cacheLineSize);
+    mesh.y = appendItems(writer, sceneObject<float>(mesh.y), mesh.numVertices, cacheLineSize);
+    mesh.z = appendItems(writer, sceneObject<float>(mesh.z), mesh.numVertices, cacheLineSize);
+    mesh.indices =
+        appendItems(writer, sceneObject<uint32_t>(mesh.indices), 3 * (size_t)mesh.numTriangles, cacheLineSize);
+    int64_t offset = appendItems(writer, &mesh, 1);
+
+    writer.written[meshRef] = offset;
+    return offset;
+}
+
+// Writes what hittable refers to and returns its offset. Objects reached more than once, such as a
+// BLAS shared by many instances or a primitive the SBVH duplicated, are written once.
+int64_t writeObject(SnapshotWriter& writer, const ispc::Hittable& hittable) {
+    auto found = writer.written.find(hittable.object);
+    if (found != writer.written.end()) {
+        return found->second;
+    }
+
+    int64_t offset = 0;
+    switch (hittable.type) {
+    case ispc::HittableType::SPHERE:
+        offset = appendItems(writer, sceneObject<ispc::Sphere>(hittable.object), 1);
+        break;
+    case ispc::HittableType::QUAD:
+        offset = appendItems(writer, sceneObject<ispc::Quad>(hittable.object), 1);
+        break;
+    case ispc::HittableType::TRIANGLE: {
+        ispc::Triangle triangle = *sceneObject<ispc::Triangle>(hittable.object);
+        triangle.mesh = writeMesh(writer, triangle.mesh);
+        offset = appendItems(writer, &triangle, 1);
+        break;
+    }
+    case ispc::HittableType::NODE:
+        offset = appendItems(writer, sceneObject<ispc::Node>(hittable.object), 1);
+        break;
+    case ispc::HittableType::BVH: {
+        ispc::Bvh bvh = *sceneObject<ispc::Bvh>(hittable.object);
+        if (bvh.leaves != 0) {
+            bvh.leaves = appendItems(writer, sceneObject<ispc::LeafPrimitives>(bvh.leaves), bvh.numNodes);
+            bvh.spheres = appendItems(writer, sceneObject<ispc::Sphere>(bvh.spheres), bvh.numSpheres, cacheLineSize);
+            bvh.quads = appendItems(writer, sceneObject<ispc::Quad>(bvh.quads), bvh.numQuads, cacheLineSize);
+            bvh.sphereBlocks = appendItems(writer, sceneObject<ispc::SphereBlock>(bvh.sphereBlocks),
+                                           bvh.numSphereBlocks, cacheLineSize);
+            bvh.quadBlocks =
+                appendItems(writer, sceneObject<ispc::QuadBlock>(bvh.quadBlocks), bvh.numQuadBlocks, cacheLineSize);
+        }
+        bvh.nodes = appendItems(writer, sceneObject<ispc::Node>(bvh.nodes), bvh.numNodes, cacheLineSize);
+        bvh.objects = writeHittables(writer, bvh.objects, bvh.numObjects);
+        offset = appendItems(writer, &bvh, 1);
+        break;
+    }
+    case ispc::HittableType::WIDE_BVH: {
+        ispc::WideBvh bvh = *sceneObject<ispc::WideBvh>(hittable.object);
+        bvh.nodes = appendItems(writer, sceneObject<ispc::WideNode>(bvh.nodes), bvh.numNodes, cacheLineSize);
+        bvh.objects = writeHittables(writer, bvh.objects, bvh.numObjects);
+        offset = appendItems(writer, &bvh, 1);
+        break;
+    }
+    case ispc::HittableType::COMPACT_BVH: {
+        ispc::CompactBvh bvh = *sceneObject<ispc::CompactBvh>(hittable.object);
+        bvh.nodes = appendItems(writer, sceneObject<ispc::CompactNode>(bvh.nodes), bvh.numNodes, cacheLineSize);
+        bvh.objects = writeHittables(writer, bvh.objects, bvh.numObjects);
+        offset = appendItems(writer, &bvh, 1);
+        break;
+    }
+    case ispc::HittableType::QUANTIZED_BVH: {
+        ispc::QuantizedBvh bvh = *sceneObject<ispc::QuantizedBvh>(hittable.object);
+        bvh.nodes = appendItems(writer, sceneObject<ispc::QuantizedNode>(bvh.nodes), bvh.numNodes, cacheLineSize);
+        bvh.objects = writeHittables(writer, bvh.objects, bvh.numObjects);
+        offset = appendItems(writer, &bvh, 1);
+        break;
+    }
+    case ispc::HittableType::INSTANCE: {
+        ispc::Instance instance = *sceneObject<ispc::Instance>(hittable.object);
+        instance.object.object = writeObject(writer, instance.object);
+        offset = appendItems(writer, &instance, 1);
+        break;
+    }
+    }
+
+    writer.written[hittable.object] = offset;
+    return offset;
+}
+
+// Writes an array of hittables, then what each of them refers to, and points the copies at the
+// written objects.
+int64_t writeHittables(SnapshotWriter& writer, int64_t objects, size_t count) {
+    auto found = writer.written.find(objects);
+    if (found != writer.written.end()) {
+        return found->second;
+    }
+
+    const ispc::Hittable* hittables = sceneObject<ispc::Hittable>(objects);
+    int64_t offset = appendItems(writer, hittables, count, cacheLineSize);
+    for (size_t i = 0; i < count; i++) {
+        // Writing the object may have grown the buffer, so the copy is found again by offset.
+        int64_t object = writeObject(writer, hittables[i]);
+        itemAt<ispc::Hittable>(writer, offset + i * sizeof(ispc::Hittable)).object = object;
+    }
+
+    writer.written[objects] = offset;
+    return offset;
+}
+
+// Saves the scene as it is about to be rendered. The file is written under a temporary name and
+// renamed, so a renderer starting at the same time never maps a partial snapshot.
+bool writeSnapshot(const char* path, uint64_t key, const ispc::Camera& camera, const ispc::HittableList& hittableList) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    SnapshotWriter writer;
+    SnapshotHeader header = {};
+    appendItems(writer, &header, 1);
+
+    memcpy(header.magic, snapshotMagic, sizeof(header.magic));
+    header.version = snapshotVersion;
+    header.headerSize = sizeof(SnapshotHeader);
+    header.key = key;
+    header.camera = camera;
+    header.hittableList = hittableList;
+    header.hittableList.objects = writeHittables(writer, hittableList.objects, hittableList.numObjects);
+    header.fileSize = writer.data.size();
+    itemAt<SnapshotHeader>(writer, 0) = header;
+
+    std::string temporaryPath = std::string(path) + ".tmp";
+    std::ofstream file(temporaryPath, std::ios::binary);
+    file.write(writer.data.data(), writer.data.size());
+    file.close();
+    if (!file || std::rename(temporaryPath.c_str(), path) != 0) {
+        std::cout << "Could not write snapshot " << path << std::endl;
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    std::cout << "Snapshot written to " << path << " (" << writer.data.size() << " bytes) in " << duration.count()
+              << " milliseconds" << std::endl;
+    return true;
+}
+
+// A mapped snapshot, with copies of its camera and hittable list for the renderer to own.
+struct Snapshot {
+    void* mapping;
+    size_t size;
+    ispc::Camera* camera;
+    ispc::HittableList* hittableList;
+};
+
+// Maps the snapshot at path if there is one built with the same settings, and makes it the scene
+// base. Returns false, leaving nothing mapped, if the scene has to be built instead.
+bool loadSnapshot(const char* path, uint64_t key, Snapshot& snapshot) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || (size_t)fileStat.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        std::cout << "Ignoring snapshot " << path << ": not a snapshot" << std::endl;
+        return false;
+    }
+
+    size_t size = fileStat.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cout << "Ignoring snapshot " << path << ": could not map it" << std::endl;
+        return false;
+    }
+
+    const SnapshotHeader& header = *(const SnapshotHeader*)mapping;
+    const char* problem = nullptr;
+    if (memcmp(header.magic, snapshotMagic, sizeof(header.magic)) != 0) {
+        problem = "not a snapshot";
+    } else if (header.version != snapshotVersion || header.headerSize != sizeof(SnapshotHeader)) {
+        problem = "written by a different version";
+    } else if (header.fileSize != size) {
+        problem = "truncated";
+    } else if (header.key != key) {
+        problem = "built with different settings";
+    }
+    if (problem != nullptr) {
+        munmap(mapping, size);
+        std::cout << "Ignoring snapshot " << path << ": " << problem << std::endl;
+        return false;
+    }
+
+    useSceneBase((int64_t)mapping);
+    snapshot.mapping = mapping;
+    snapshot.size = size;
+    snapshot.camera = new ispc::Camera(header.camera);
+    snapshot.hittableList = new ispc::HittableList(header.hittableList);
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+    std::cout << "Snapshot loaded from " << path << " (" << size << " bytes) in " << duration.count()
+              << " microseconds" << std::endl;
+    return true;
+}
+
+void unloadSnapshot(Snapshot& snapshot) {
+    munmap(snapshot.mapping, snapshot.size);
+    useSceneBase(0);
+}
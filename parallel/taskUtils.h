@@ -0,0 +1,49 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+
+// Host-side access to the task system in tasksys.cpp. Work launched from here runs on the same
+// worker threads that execute the launch[] statements in the ISPC kernels, so host passes such as
+// the BVH build do not spin up a second pool.
+
+extern "C" {
+void ISPCLaunch(void** handlePtr, void* f, void* data, int countx, int county, int countz);
+void ISPCSync(void* handle);
+}
+
+template <typename F>
+void taskEntry(void* data, int /*threadIndex*/, int /*threadCount*/, int taskIndex, int taskCount, int, int, int, int,
+               int, int) {
+    (*(F*)data)(taskIndex, taskCount);
+}
+
+// Runs fn(taskIndex, taskCount) for every task index in [0, taskCount) and returns once all of them
+// have finished. Can be called from inside a task; the waiting thread helps run queued tasks.
+template <typename F>
+void launchTasks(int taskCount, F&& fn) {
+    using Fn = std::remove_reference_t<F>;
+    if (taskCount <= 1) {
+        fn(0, 1);
+        return;
+    }
+
+    void* handle = nullptr;
+    ISPCLaunch(&handle, (void*)&taskEntry<Fn>, (void*)std::addressof(fn), taskCount, 1, 1);
+    ISPCSync(handle);
+}
+
+// Splits [0, count) into at most maxTasks contiguous chunks of at least minChunk elements and
+// runs fn(begin, end, chunkIndex) for each of them in parallel.
+template <typename F>
+int parallelChunks(size_t count, size_t minChunk, int maxTasks, F&& fn) {
+    int chunks = (int)std::clamp<size_t>(count / std::max<size_t>(minChunk, 1), 1, std::max(maxTasks, 1));
+    size_t chunkSize = (count + chunks - 1) / chunks;
+    launchTasks(chunks, [&](int task, int) {
+        size_t begin = std::min(count, task * chunkSize);
+        size_t end = std::min(count, begin + chunkSize);
+        fn(begin, end, task);
+    });
+    return chunks;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "bvh.h"
+#include "raytracer.h"
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+// Collapsing a binary BVH into a BVH4 / BVH8
+
+const uint32_t wideBvhMaxWidth = std::size(ispc::WideNode{}.child);
+
+// Entries in the stacks of the wide and quantized traversals (WIDE_BVH_STACK_SIZE in raytracer.ispc)
+const uint32_t wideBvhStackSize = 256;
+
+bool isLeaf(const ispc::Node& node) { return node.left == node.right; }
+
+void setWideChild(ispc::WideNode& wide, uint32_t slot, const ispc::aabb& box, uint32_t child, uint32_t count) {
+    wide.minX[slot] = box.x.min;
+    wide.minY[slot] = box.y.min;
+    wide.minZ[slot] = box.z.min;
+    wide.maxX[slot] = box.x.max;
+    wide.maxY[slot] = box.y.max;
+    wide.maxZ[slot] = box.z.max;
+    wide.child[slot] = child;
+    wide.count[slot] = count;
+}
+
+// Pulls grandchildren up into the node by repeatedly opening the inner child with the largest
+// surface area until the node is full, then collapses the remaining inner children recursively.
+uint32_t collapseNode(const std::vector<ispc::Node>& nodes, std::vector<ispc::WideNode>& wideNodes, uint32_t nodeIndex,
+                      uint32_t width) {
+    uint32_t wideIndex = wideNodes.size();
+    wideNodes.emplace_back();
+
+    uint32_t children[wideBvhMaxWidth];
+    uint32_t numChildren = 0;
+    const ispc::Node& node = nodes[nodeIndex];
+    if (isLeaf(node)) {
+        children[numChildren++] = nodeIndex;
+    } else {
+        children[numChildren++] = node.left;
+        children[numChildren++] = node.right;
+    }
+
+    while (numChildren < width) {
+        int best = -1;
+        float bestArea = -1.0f;
+        for (uint32_t i = 0; i < numChildren; i++) {
+            const ispc::Node& child = nodes[children[i]];
+            if (!isLeaf(child) && surfaceArea(child.bbox) > bestArea) {
+                best = i;
+                bestArea = surfaceArea(child.bbox);
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+
+        const ispc::Node& opened = nodes[children[best]];
+        children[best] = opened.left;
+        children[numChildren++] = opened.right;
+    }
+
+    ispc::WideNode wide = {};
+    wide.numChildren = numChildren;
+    for (uint32_t i = 0; i < numChildren; i++) {
+        const ispc::Node& child = nodes[children[i]];
+        if (isLeaf(child)) {
+            setWideChild(wide, i, child.bbox, child.start, child.size);
+        } else {
+            setWideChild(wide, i, child.bbox, collapseNode(nodes, wideNodes, children[i], width), 0);
+        }
+    }
+    wideNodes[wideIndex] = wide;
+    return wideIndex;
+}
+
+// Most entries the wide traversals hold on their stack below nodeIndex, with pending entries
+// already under it. Visiting a node pops it and pushes all of its children.
+uint32_t wideStackEntries(const std::vector<ispc::WideNode>& wideNodes, uint32_t nodeIndex, uint32_t pending = 0) {
+    const ispc::WideNode& node = wideNodes[nodeIndex];
+    uint32_t entries = pending + node.numChildren;
+    uint32_t most = entries;
+    for (uint32_t i = 0; i < node.numChildren; i++) {
+        if (node.count[i] == 0) {
+            most = std::max(most, wideStackEntries(wideNodes, node.child[i], entries - 1));
+        }
+    }
+    return most;
+}
+
+// Builds the wide tree over the same ordered objects as the binary one, so both can be kept
+// around and compared.
+ispc::WideBvh* createWideBVH(const ispc::Bvh& bvh, const std::vector<ispc::Node>& nodes,
+                             std::vector<ispc::WideNode>& wideNodes, uint32_t width) {
+    width = std::clamp(width, 2u, wideBvhMaxWidth);
+
+    wideNodes.clear();
+    wideNodes.reserve(nodes.size() / 2 + 1);
+    collapseNode(nodes, wideNodes, bvh.root, width);
+
+    ispc::WideBvh* wideBvh = new ispc::WideBvh;
+    wideBvh->objects = bvh.objects;
+    wideBvh->numObjects = bvh.numObjects;
+    wideBvh->nodes = sceneRef(wideNodes.data());
+    wideBvh->numNodes = wideNodes.size();
+    wideBvh->bbox = nodes[bvh.root].bbox;
+    return wideBvh;
+}
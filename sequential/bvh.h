@@ -4,74 +4,276 @@
 #include "rtweekend.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "quad.h"
+#include "sphere.h"
 
 #include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <variant>
+#include <vector>
 
-class bvh_node : public hittable {
-    public:
+// Flat BVH built top-down with binned SAH. Nodes live in one array in depth-first order, so the
+// left child of an inner node is the node right after it. The primitives are copied by value into
+// one array in leaf order, so traversal is a loop over two arrays with no virtual calls and no
+// pointer chasing.
 
-    bvh_node(const hittable_list& list) : bvh_node(list.objects, 0, list.objects.size()) {}
+using primitive = std::variant<sphere, quad>;
 
-    bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end) {
-        auto objects = src_objects;
-        int axis = random_int(0, 2);
-        auto comparator = (axis == 0) ? box_x_compare
-                        : (axis == 1) ? box_y_compare
-                                      : box_z_compare;
+struct bvh_flat_node {
+    aabb bbox;
+    uint32_t offset; // Right child of an inner node, or first primitive of a leaf
+    uint32_t count;  // Number of primitives in a leaf, 0 for an inner node
+};
 
-        size_t object_span = end - start;
+class bvh : public hittable {
+    public:
 
-        if (object_span == 1) {
-            left = right = objects[start];
-        } else if (object_span == 2) {
-            if (comparator(objects[start], objects[start + 1])) {
-                left = objects[start];
-                right = objects[start + 1];
-            } else {
-                left = objects[start + 1];
-                right = objects[start];
-            }
-        } else {
-            std::sort(objects.begin() + start, objects.begin() + end, comparator);
-            auto mid = start + object_span / 2.0f;
-            left = std::make_shared<bvh_node>(objects, start, mid);
-            right = std::make_shared<bvh_node>(objects, mid, end);
+    bvh(const hittable_list& list, uint32_t max_leaf_size = 4) : max_leaf_size(max_leaf_size) {
+        std::vector<primitive> unsorted;
+        for (const auto& object : list.objects) {
+            add_primitives(object, unsorted);
+        }
+        if (unsorted.empty()) {
+            return;
+        }
+
+        std::vector<build_ref> refs;
+        refs.reserve(unsorted.size());
+        for (uint32_t i = 0; i < unsorted.size(); i++) {
+            aabb box = primitive_box(unsorted[i]);
+            point3 centroid(0.5f * (box.x.min + box.x.max), 0.5f * (box.y.min + box.y.max),
+                            0.5f * (box.z.min + box.z.max));
+            refs.push_back({box, centroid, i});
         }
 
-        bbox = aabb(left->bound_box(), right->bound_box());
+        nodes.reserve(2 * refs.size());
+        build(refs, 0, refs.size(), 0);
+
+        primitives.reserve(refs.size());
+        for (const auto& ref : refs) {
+            primitives.push_back(unsorted[ref.index]);
+        }
+        bbox = nodes[0].bbox;
     }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        if(!bbox.hit(r, ray_t)) return false;
+        if (nodes.empty()) {
+            return false;
+        }
 
-        bool hit_left = left->hit(r, ray_t, rec);
-        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+        point3 origin = r.origin();
+        vec3 direction = r.direction();
+        vec3 inv_dir(1.0f / direction.x(), 1.0f / direction.y(), 1.0f / direction.z());
 
-        return hit_left || hit_right;
+        bool hit_anything = false;
+        float closest_so_far = ray_t.max;
+
+        uint32_t stack[stack_size];
+        float stack_t[stack_size];
+        int stack_top = 0;
+
+        uint32_t node_index = 0;
+        if (entry_distance(nodes[0].bbox, origin, inv_dir, ray_t.min, closest_so_far) == infinity) {
+            return false;
+        }
+
+        while (true) {
+            const bvh_flat_node& node = nodes[node_index];
+            if (node.count > 0) {
+                for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                    if (hit_primitive(primitives[i], r, interval(ray_t.min, closest_so_far), rec)) {
+                        hit_anything = true;
+                        closest_so_far = rec.t;
+                    }
+                }
+            } else {
+                // Visit the nearer child first, so the farther one can be skipped if a hit is found
+                // before it is popped.
+                uint32_t near = node_index + 1;
+                uint32_t far = node.offset;
+                float near_t = entry_distance(nodes[near].bbox, origin, inv_dir, ray_t.min, closest_so_far);
+                float far_t = entry_distance(nodes[far].bbox, origin, inv_dir, ray_t.min, closest_so_far);
+                if (far_t < near_t) {
+                    std::swap(near, far);
+                    std::swap(near_t, far_t);
+                }
+
+                if (near_t != infinity) {
+                    if (far_t != infinity) {
+                        stack[stack_top] = far;
+                        stack_t[stack_top] = far_t;
+                        stack_top++;
+                    }
+                    node_index = near;
+                    continue;
+                }
+            }
+
+            do {
+                if (stack_top == 0) {
+                    return hit_anything;
+                }
+                stack_top--;
+            } while (stack_t[stack_top] >= closest_so_far);
+            node_index = stack[stack_top];
+        }
     }
 
     aabb bound_box() const override { return bbox; }
 
     private:
-    shared_ptr<hittable> left;
-    shared_ptr<hittable> right;
+    static const int num_bins = 16;
+    static const int stack_size = 128;
+    static const int max_sah_depth = 64; // Deeper nodes split at the median, which bounds the depth
+    static constexpr float traversal_cost = 1.0f;
+    static constexpr float intersection_cost = 1.0f;
+
+    struct build_ref {
+        aabb bbox;
+        point3 centroid;
+        uint32_t index;
+    };
+
+    struct bin {
+        aabb bbox;
+        uint32_t count = 0;
+    };
+
+    std::vector<bvh_flat_node> nodes;
+    std::vector<primitive> primitives;
+    uint32_t max_leaf_size;
     aabb bbox;
 
+    static void add_primitives(const shared_ptr<hittable>& object, std::vector<primitive>& out) {
+        if (auto s = std::dynamic_pointer_cast<sphere>(object)) {
+            out.emplace_back(*s);
+        } else if (auto q = std::dynamic_pointer_cast<quad>(object)) {
+            out.emplace_back(*q);
+        } else if (auto list = std::dynamic_pointer_cast<hittable_list>(object)) {
+            for (const auto& child : list->objects) {
+                add_primitives(child, out);
+            }
+        } else {
+            std::clog << "bvh: skipping an object that is not a sphere, quad or hittable_list" << std::endl;
+        }
+    }
+
+    // sphere and quad are final, so these calls bind statically and are not virtual.
+    static aabb primitive_box(const primitive& p) {
+        return std::visit([](const auto& object) { return object.bound_box(); }, p);
+    }
 
-    static bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis_index) {
-        return a->bound_box().axis(axis_index).min < b->bound_box().axis(axis_index).min;   
+    static bool hit_primitive(const primitive& p, const ray& r, interval ray_t, hit_record& rec) {
+        return std::visit([&](const auto& object) { return object.hit(r, ray_t, rec); }, p);
     }
 
-    static bool box_x_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-        return box_compare(a, b, 0);
+    static float surface_area(const aabb& box) {
+        float dx = box.x.size();
+        float dy = box.y.size();
+        float dz = box.z.size();
+        return 2.0f * (dx * dy + dy * dz + dz * dx);
     }
 
-    static bool box_y_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-        return box_compare(a, b, 1);
+    // Distance at which the ray enters box within (t_min, t_max), or infinity if it misses.
+    static float entry_distance(const aabb& box, const point3& origin, const vec3& inv_dir, float t_min,
+                                float t_max) {
+        for (int a = 0; a < 3; a++) {
+            float t0 = (box.axis(a).min - origin[a]) * inv_dir[a];
+            float t1 = (box.axis(a).max - origin[a]) * inv_dir[a];
+            if (inv_dir[a] < 0.0f) {
+                std::swap(t0, t1);
+            }
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+        }
+        return t_min <= t_max ? t_min : infinity;
     }
 
-    static bool box_z_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-        return box_compare(a, b, 2);
+    // Builds the subtree over refs[start, end) at the end of nodes and returns its index.
+    uint32_t build(std::vector<build_ref>& refs, size_t start, size_t end, int depth) {
+        uint32_t node_index = nodes.size();
+        nodes.emplace_back();
+
+        aabb box;
+        aabb centroid_box;
+        for (size_t i = start; i < end; i++) {
+            box = aabb(box, refs[i].bbox);
+            centroid_box = aabb(centroid_box, aabb(refs[i].centroid, refs[i].centroid));
+        }
+
+        size_t count = end - start;
+        float leaf_cost = intersection_cost * count;
+        float best_cost = infinity;
+        int best_axis = -1;
+        int best_split = 0;
+
+        for (int axis = 0; axis < 3 && count > 1 && depth < max_sah_depth; axis++) {
+            const interval& extent = centroid_box.axis(axis);
+            if (extent.size() <= 0.0f) {
+                continue;
+            }
+
+            bin bins[num_bins];
+            float scale = num_bins / extent.size();
+            for (size_t i = start; i < end; i++) {
+                int b = std::clamp(static_cast<int>((refs[i].centroid[axis] - extent.min) * scale), 0, num_bins - 1);
+                bins[b].bbox = aabb(bins[b].bbox, refs[i].bbox);
+                bins[b].count++;
+            }
+
+            // Right-to-left sweep for the areas and counts to the right of every split
+            float right_area[num_bins];
+            uint32_t right_count[num_bins];
+            aabb right_box;
+            uint32_t right_total = 0;
+            for (int b = num_bins - 1; b > 0; b--) {
+                right_box = aabb(right_box, bins[b].bbox);
+                right_total += bins[b].count;
+                right_area[b] = surface_area(right_box);
+                right_count[b] = right_total;
+            }
+
+            aabb left_box;
+            uint32_t left_total = 0;
+            for (int b = 1; b < num_bins; b++) {
+                left_box = aabb(left_box, bins[b - 1].bbox);
+                left_total += bins[b - 1].count;
+                if (left_total == 0 || right_count[b] == 0) {
+                    continue;
+                }
+                float cost = traversal_cost + intersection_cost *
+                                                  (surface_area(left_box) * left_total + right_area[b] * right_count[b]) /
+                                                  surface_area(box);
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = b;
+                }
+            }
+        }
+
+        size_t mid;
+        if (best_axis >= 0 && (count > max_leaf_size || best_cost < leaf_cost)) {
+            const interval& extent = centroid_box.axis(best_axis);
+            float scale = num_bins / extent.size();
+            auto first_right = std::partition(refs.begin() + start, refs.begin() + end, [&](const build_ref& ref) {
+                int b = std::clamp(static_cast<int>((ref.centroid[best_axis] - extent.min) * scale), 0, num_bins - 1);
+                return b < best_split;
+            });
+            mid = first_right - refs.begin();
+        } else if (count > max_leaf_size) {
+            // Every centroid is in the same place, or the tree is already deep.
+            mid = start + count / 2;
+        } else {
+            nodes[node_index] = {box, static_cast<uint32_t>(start), static_cast<uint32_t>(count)};
+            return node_index;
+        }
+
+        build(refs, start, mid, depth + 1);
+        uint32_t right = build(refs, mid, end, depth + 1);
+        nodes[node_index] = {box, right, 0};
+        return node_index;
     }
 };
 
@@ -25,7 +25,7 @@ void quads() {
     world.add(make_shared<quad>(point3(-2, -3, 5), vec3(4, 0, 0), vec3(0, 0, -4), lower_teal));
     
 
-    world = hittable_list(make_shared<bvh_node>(world));
+    world = hittable_list(make_shared<bvh>(world));
 
     camera cam;
 
@@ -58,7 +58,7 @@ void simple_light() {
     world.add(make_shared<sphere>(point3(0,7,0), 2, difflight));
     world.add(make_shared<quad>(point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0), difflight));
 
-    world = hittable_list(make_shared<bvh_node>(world));
+    world = hittable_list(make_shared<bvh>(world));
 
     camera cam;
 
@@ -107,7 +107,7 @@ void cornell_box() {
     // world.add(box(point3(130, 0, 65), point3(295, 165, 230), make_shared<glass>(1.5)));
     // world.add(box(point3(265, 0, 295), point3(430, 330, 460), make_shared<mirror>(color(0.7, 0.6, 0.5))));
     
-//    world = hittable_list(make_shared<bvh_node>(world));
+//    world = hittable_list(make_shared<bvh>(world));
 
     camera cam;
 
@@ -205,7 +205,7 @@ void randomSpheres() {
 
     auto material3 = make_shared<mirror>(color(0.7f, 0.6f, 0.5f));
     world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-    world = hittable_list(make_shared<bvh_node>(world));
+    world = hittable_list(make_shared<bvh>(world));
     camera cam;
 
     cam.aspect_ratio      = 16.0 / 9.0;
@@ -267,7 +267,7 @@ void randomSpheresExtra() {
 
     auto material3 = make_shared<mirror>(color(0.7, 0.6, 0.5));
     world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-    world = hittable_list(make_shared<bvh_node>(world));
+    world = hittable_list(make_shared<bvh>(world));
     camera cam;
 
     cam.aspect_ratio      = 16.0 / 9.0;
@@ -6,7 +6,7 @@
 #include "hittable.h"
 #include "hittable_list.h"
 
-class quad : public hittable {
+class quad final : public hittable {
     public:
         quad(const point3& _Q, const vec3& _u, const vec3& _v, shared_ptr<material> m) :
             Q(_Q), u(_u), v(_v), mat(m) {
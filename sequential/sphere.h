@@ -4,7 +4,7 @@
 #include "hittable.h"
 #include "vec3.h"
 
-class sphere : public hittable {
+class sphere final : public hittable {
 public:
     sphere(point3 _center, float _radius, shared_ptr<material> _material) : center(_center), radius(_radius), mat(_material) {
         auto rvec = vec3(radius, radius, radius);